@@ -23,6 +23,8 @@
 #include <linux/crc32.h>
 #include <net/bluetooth/bluetooth.h>
 
+#include "../l2shape.h"
+
 /* Limits */
 #define BNEP_MAX_PROTO_FILTERS		5
 #define BNEP_MAX_MULTICAST_FILTERS	20
@@ -165,6 +167,7 @@ struct bnep_session {
 	unsigned long long mc_filter;
 
 	struct socket    *sock;
+	struct l2shape   shape;
 	struct net_device *dev;
 };
 
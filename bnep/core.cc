@@ -57,10 +57,9 @@ void BNEP_CORE::__bnep_unlink_session(struct bnep_session *s)
 
 int BNEP_CORE::bnep_send(struct bnep_session *s, void *data, size_t len)
 {
-	struct socket *sock = s->sock;
 	struct kvec iv = { data, len };
 
-	return kernel_sendmsg(sock, &s->msg, &iv, 1, len);
+	return l2shape_sendmsg(&s->shape, &s->msg, &iv, 1, len);
 }
 
 int BNEP_CORE::bnep_send_rsp(struct bnep_session *s, u8 ctrl, u16 resp)
@@ -361,7 +360,6 @@ badframe:
 int BNEP_CORE::bnep_tx_frame(struct bnep_session *s, struct sk_buff *skb)
 {
 	struct ethhdr *eh = (void *) skb->data;
-	struct socket *sock = s->sock;
 	struct kvec iv[3];
 	int len = 0, il = 0;
 	u8 type = 0;
@@ -404,7 +402,7 @@ send:
 
 	/* FIXME: linearize skb */
 	{
-		len = kernel_sendmsg(sock, &s->msg, iv, il, len);
+		len = l2shape_sendmsg(&s->shape, &s->msg, iv, il, len);
 	}
 	kfree_skb(skb);
 
@@ -471,6 +469,7 @@ int BNEP_CORE::bnep_session_cls(void *arg)
 	wake_up_interruptible(sk_sleep(s->sock->sk));
 
 	/* Release the socket */
+	l2shape_release(&s->shape);
 	fput(s->sock->file);
 
 	__bnep_unlink_session(s);
@@ -539,6 +538,8 @@ int BNEP_CORE::bnep_add_connection(struct bnep_connadd_req *req, struct socket *
 	s->role  = req->role;
 	s->state = BT_CONNECTED;
 
+	l2shape_init(&s->shape, &shape_params, sock);
+
 	s->msg.msg_flags = MSG_NOSIGNAL;
 
 #ifdef CONFIG_BT_BNEP_MC_FILTER
@@ -711,6 +712,8 @@ extern "C"{
 	MODULE_PARM_DESC(compress_dst, "Compress destination headers");
 }
 
+L2SHAPE_MODULE_PARAMS(shape_params);
+
 MODULE_AUTHOR("Marcel Holtmann <marcel@holtmann.org>");
 MODULE_DESCRIPTION("Bluetooth BNEP ver " VERSION);
 MODULE_VERSION(VERSION);
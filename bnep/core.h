@@ -80,6 +80,7 @@ int bnep_session(void *arg);
 
 bool compress_src = true;
 bool compress_dst = true;
+static struct l2shape_params shape_params = { 0, 0, 0, 0, 0, 0, 0, L2SHAPE_LIMIT };
 
 static u8 __bnep_rx_hlen[] = {
 	ETH_HLEN,     /* BNEP_GENERAL */
@@ -26,6 +26,8 @@
 #include <linux/types.h>
 #include <net/bluetooth/bluetooth.h>
 
+#include "../l2shape.h"
+
 #define BTNAMSIZ 18
 
 /* CMTP ioctl defines */
@@ -71,6 +73,7 @@ struct cmtp_session {
 	struct list_head list;
 
 	struct socket *sock;
+	struct l2shape shape;
 
 	bdaddr_t bdaddr;
 
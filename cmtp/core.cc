@@ -163,7 +163,6 @@ inline int CMTP_CORE::cmtp_recv_frame(struct cmtp_session *session, struct sk_bu
 
 int CMTP_CORE::cmtp_send_frame(struct cmtp_session *session, unsigned char *data, int len)
 {
-	struct socket *sock = session->sock;
 	struct kvec iv = { data, len };
 	struct msghdr msg;
 
@@ -174,7 +173,7 @@ int CMTP_CORE::cmtp_send_frame(struct cmtp_session *session, unsigned char *data
 
 	memset(&msg, 0, sizeof(msg));
 
-	return kernel_sendmsg(sock, &msg, &iv, 1, len);
+	return l2shape_sendmsg(&session->shape, &msg, &iv, 1, len);
 }
 
 void CMTP_CORE::cmtp_process_transmit(struct cmtp_session *session)
@@ -287,6 +286,7 @@ int CMTP_CORE::cmtp_session(void *arg)
 	if (!(session->flags & (1 << CMTP_LOOPBACK)))
 		cmtp_detach_device(session);
 
+	l2shape_release(&session->shape);
 	fput(session->sock->file);
 
 	__cmtp_unlink_session(session);
@@ -328,6 +328,7 @@ int CMTP_CORE::cmtp_add_connection(struct cmtp_connadd_req *req, struct socket *
 
 	session->sock  = sock;
 	session->state = BT_CONFIG;
+	l2shape_init(&session->shape, &shape_params, sock);
 
 	init_waitqueue_head(&session->wait);
 
@@ -480,6 +481,8 @@ extern "C"{
 	module_exit(cmtp_exit);
 }
 
+L2SHAPE_MODULE_PARAMS(shape_params);
+
 MODULE_AUTHOR("Marcel Holtmann <marcel@holtmann.org>");
 MODULE_DESCRIPTION("Bluetooth CMTP ver " VERSION);
 MODULE_VERSION(VERSION);
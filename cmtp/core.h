@@ -52,6 +52,8 @@
 static DECLARE_RWSEM(cmtp_session_sem);
 static LIST_HEAD(cmtp_session_list);
 
+static struct l2shape_params shape_params = { 0, 0, 0, 0, 0, 0, 0, L2SHAPE_LIMIT };
+
 class CMTP_CORE {
 private:
 	struct cmtp_session *__cmtp_get_session(bdaddr_t *bdaddr);
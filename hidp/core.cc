@@ -527,25 +527,25 @@ void HIDP_CORE::hidp_recv_intr_frame(struct hidp_session *session,
 	kfree_skb(skb);
 }
 
-int HIDP_CORE::hidp_send_frame(struct socket *sock, unsigned char *data, int len)
+int HIDP_CORE::hidp_send_frame(struct l2shape *shape, unsigned char *data, int len)
 {
 	struct kvec iv = { data, len };
 	struct msghdr msg;
 
-	BT_DBG("sock %p data %p len %d", sock, data, len);
+	BT_DBG("sock %p data %p len %d", shape->sock, data, len);
 
 	if (!len)
 		return 0;
 
 	memset(&msg, 0, sizeof(msg));
 
-	return kernel_sendmsg(sock, &msg, &iv, 1, len);
+	return l2shape_sendmsg(shape, &msg, &iv, 1, len);
 }
 
-/* dequeue message from @transmit and send via @sock */
+/* dequeue message from @transmit and send via @shape */
 void HIDP_CORE::hidp_process_transmit(struct hidp_session *session,
 				  struct sk_buff_head *transmit,
-				  struct socket *sock)
+				  struct l2shape *shape)
 {
 	struct sk_buff *skb;
 	int ret;
@@ -553,7 +553,7 @@ void HIDP_CORE::hidp_process_transmit(struct hidp_session *session,
 	BT_DBG("session %p", session);
 
 	while ((skb = skb_dequeue(transmit))) {
-		ret = hidp_send_frame(sock, skb->data, skb->len);
+		ret = hidp_send_frame(shape, skb->data, skb->len);
 		if (ret == -EAGAIN) {
 			skb_queue_head(transmit, skb);
 			break;
@@ -837,6 +837,8 @@ int HIDP_CORE::hidp_session_new(struct hidp_session **out, const bdaddr_t *bdadd
 	session->user.remove = hidp_session_remove;
 	session->ctrl_sock = ctrl_sock;
 	session->intr_sock = intr_sock;
+	l2shape_init(&session->ctrl_shape, &shape_params, ctrl_sock);
+	l2shape_init(&session->intr_shape, &shape_params, intr_sock);
 	skb_queue_head_init(&session->ctrl_transmit);
 	skb_queue_head_init(&session->intr_transmit);
 	session->ctrl_mtu = min_t(uint, l2cap_pi(ctrl)->chan->omtu,
@@ -883,6 +885,8 @@ void HIDP_CORE::session_free_cls(struct kref *ref)
 	hidp_session_dev_destroy(session);
 	skb_queue_purge(&session->ctrl_transmit);
 	skb_queue_purge(&session->intr_transmit);
+	l2shape_release(&session->intr_shape);
+	l2shape_release(&session->ctrl_shape);
 	fput(session->intr_sock->file);
 	fput(session->ctrl_sock->file);
 	l2cap_conn_put(session->conn);
@@ -1105,7 +1109,7 @@ void HIDP_CORE::hidp_session_run(struct hidp_session *session)
 
 		/* send pending intr-skbs */
 		hidp_process_transmit(session, &session->intr_transmit,
-				      session->intr_sock);
+				      &session->intr_shape);
 
 		/* parse incoming ctrl-skbs */
 		while ((skb = skb_dequeue(&ctrl_sk->sk_receive_queue))) {
@@ -1118,7 +1122,7 @@ void HIDP_CORE::hidp_session_run(struct hidp_session *session)
 
 		/* send pending ctrl-skbs */
 		hidp_process_transmit(session, &session->ctrl_transmit,
-				      session->ctrl_sock);
+				      &session->ctrl_shape);
 
 		schedule();
 	}
@@ -1403,6 +1407,8 @@ extern "C"{
 module_init(hidp_init);
 module_exit(hidp_exit);
 
+L2SHAPE_MODULE_PARAMS(shape_params);
+
 MODULE_AUTHOR("Marcel Holtmann <marcel@holtmann.org>");
 MODULE_AUTHOR("David Herrmann <dh.herrmann@gmail.com>");
 MODULE_DESCRIPTION("Bluetooth HIDP ver " VERSION);
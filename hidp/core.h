@@ -39,6 +39,8 @@
 static DECLARE_RWSEM(hidp_session_sem);
 static LIST_HEAD(hidp_session_list);
 
+static struct l2shape_params shape_params = { 0, 0, 0, 0, 0, 0, 0, L2SHAPE_LIMIT };
+
 static unsigned char hidp_keycode[256] = {
 	  0,   0,   0,   0,  30,  48,  46,  32,  18,  33,  34,  35,  23,  36,
 	 37,  38,  50,  49,  24,  25,  16,  19,  31,  20,  22,  47,  17,  45,
@@ -100,12 +102,12 @@ private:
 	int hidp_process_data(struct hidp_session *session, struct sk_buff *skb, unsigned char param);
 	void hidp_recv_ctrl_frame(struct hidp_session *session, struct sk_buff *skb);
 	void hidp_recv_intr_frame(struct hidp_session *session, struct sk_buff *skb);
-	int hidp_send_frame(struct socket *sock, unsigned char *data, int len);
+	int hidp_send_frame(struct l2shape *shape, unsigned char *data, int len);
 
-	/* dequeue message from @transmit and send via @sock */
+	/* dequeue message from @transmit and send via @shape */
 	void hidp_process_transmit(struct hidp_session *session,
 					  struct sk_buff_head *transmit,
-					  struct socket *sock);
+					  struct l2shape *shape);
 	int hidp_setup_input(struct hidp_session *session, struct hidp_connadd_req *req);
 
 	/* This function sets up the hid device. It does not add it
@@ -28,6 +28,8 @@
 #include <net/bluetooth/bluetooth.h>
 #include <net/bluetooth/l2cap.h>
 
+#include "../l2shape.h"
+
 /* HIDP header masks */
 #define HIDP_HEADER_TRANS_MASK			0xf0
 #define HIDP_HEADER_PARAM_MASK			0x0f
@@ -149,6 +151,8 @@ struct hidp_session {
 	struct l2cap_user user;
 	struct socket *ctrl_sock;
 	struct socket *intr_sock;
+	struct l2shape ctrl_shape;
+	struct l2shape intr_shape;
 	struct sk_buff_head ctrl_transmit;
 	struct sk_buff_head intr_transmit;
 	uint ctrl_mtu;
@@ -0,0 +1,312 @@
+/*
+   L2CAP link shaping for the Linux Bluetooth stack (BlueZ) profiles,
+   shared by RFCOMM, BNEP, CMTP and HIDP.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation;
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT OF THIRD PARTY RIGHTS.
+   IN NO EVENT SHALL THE COPYRIGHT HOLDER(S) AND AUTHOR(S) BE LIABLE FOR ANY
+   CLAIM, OR ANY SPECIAL INDIRECT OR CONSEQUENTIAL DAMAGES, OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+   ALL LIABILITY, INCLUDING LIABILITY FOR INFRINGEMENT OF ANY PATENTS,
+   COPYRIGHTS, TRADEMARKS OR OTHER RIGHTS, RELATING TO USE OF THIS
+   SOFTWARE IS DISCLAIMED.
+*/
+
+/*
+ * L2CAP link shaping for the profiles.
+ *
+ * Sits between a profile and kernel_sendmsg() on one of its L2CAP
+ * sockets and delays frames the way a congested baseband link would:
+ * limited rate, propagation delay, jitter, and baseband packets that
+ * are lost and retransmitted. Frames larger than the emulated L2CAP
+ * MTU are refused with -EMSGSIZE. Frames are never reordered, and a frame
+ * the socket refuses stays queued and is retried; until it goes out,
+ * senders get the error like they would from the socket itself. Only
+ * l2shape_release() drops what the socket still won't take. With all
+ * parameters zero, frames go straight to the socket.
+ *
+ * Departures are timed by an hrtimer, which hands the send to a work
+ * item since kernel_sendmsg() may sleep. Times are in usecs, but what
+ * counts in the end is hrtimer resolution plus workqueue latency,
+ * typically some usecs rather than a jiffy.
+ *
+ * Meant for virtual controllers (hci_vhci), where the link itself is
+ * perfect. Each profile module has its own set of shape_* parameters.
+ */
+
+#ifndef __BT_L2SHAPE_H
+#define __BT_L2SHAPE_H
+
+#include <linux/random.h>
+#include <linux/hrtimer.h>
+
+#define L2SHAPE_LIMIT		65536	/* default queue limit, bytes */
+#define L2SHAPE_L2CAP_HDR	4
+#define L2SHAPE_BB_HDR		4	/* per baseband packet */
+#define L2SHAPE_RETRY		(10 * NSEC_PER_MSEC)
+
+struct l2shape_params {
+	unsigned int	rate;		/* bytes/s on air, 0 is unlimited */
+	unsigned int	delay;		/* usecs */
+	unsigned int	jitter;		/* usecs, uniform from 0 */
+	unsigned int	loss;		/* per mille of baseband packets */
+	unsigned int	retrans;	/* usecs added per lost packet */
+	unsigned int	seg;		/* baseband packet payload, 0 is unlimited */
+	unsigned int	mtu;		/* largest L2CAP frame, 0 is unlimited */
+	unsigned int	limit;		/* queued bytes before senders block */
+};
+
+struct l2shape {
+	struct l2shape_params	*p;
+	struct socket		*sock;
+
+	spinlock_t		lock;
+	struct sk_buff_head	queue;
+	unsigned int		queued;
+	bool			inflight;
+	bool			stopped;	/* by l2shape_release() */
+	int			err;		/* of the frame being retried */
+	u64			busy_until;	/* ns, link busy up to then */
+
+	struct hrtimer		timer;		/* next departure */
+	struct work_struct	work;
+	wait_queue_head_t	wait;
+};
+
+/* Departure time of a queued frame */
+struct l2shape_cb {
+	u64	due;
+};
+
+#define l2shape_cb(skb) ((struct l2shape_cb *) ((skb)->cb))
+
+#define L2SHAPE_MODULE_PARAMS(p) \
+	module_param_named(shape_rate, (p).rate, uint, 0644); \
+	MODULE_PARM_DESC(shape_rate, "Emulated link rate in bytes/s, 0 is unlimited"); \
+	module_param_named(shape_delay, (p).delay, uint, 0644); \
+	MODULE_PARM_DESC(shape_delay, "Emulated link delay in usecs"); \
+	module_param_named(shape_jitter, (p).jitter, uint, 0644); \
+	MODULE_PARM_DESC(shape_jitter, "Emulated link jitter in usecs"); \
+	module_param_named(shape_loss, (p).loss, uint, 0644); \
+	MODULE_PARM_DESC(shape_loss, "Emulated baseband packet loss, per mille"); \
+	module_param_named(shape_retrans, (p).retrans, uint, 0644); \
+	MODULE_PARM_DESC(shape_retrans, "Emulated retransmit delay per lost packet in usecs"); \
+	module_param_named(shape_seg, (p).seg, uint, 0644); \
+	MODULE_PARM_DESC(shape_seg, "Emulated baseband packet payload, 0 is unlimited"); \
+	module_param_named(shape_mtu, (p).mtu, uint, 0644); \
+	MODULE_PARM_DESC(shape_mtu, "Emulated L2CAP MTU, larger frames are refused, 0 is unlimited"); \
+	module_param_named(shape_limit, (p).limit, uint, 0644); \
+	MODULE_PARM_DESC(shape_limit, "Bytes queued on the emulated link before senders block")
+
+static inline bool l2shape_active(struct l2shape_params *p)
+{
+	return p->rate || p->delay || p->jitter || p->loss || p->seg;
+}
+
+static inline u64 l2shape_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+/* Called with sh->lock held */
+static inline void l2shape_arm(struct l2shape *sh, u64 due)
+{
+	if (!sh->stopped)
+		hrtimer_start(&sh->timer, ns_to_ktime(due), HRTIMER_MODE_ABS);
+}
+
+static inline enum hrtimer_restart l2shape_timeout(struct hrtimer *timer)
+{
+	struct l2shape *sh = container_of(timer, struct l2shape, timer);
+
+	schedule_work(&sh->work);
+	return HRTIMER_NORESTART;
+}
+
+static inline int l2shape_xmit(struct l2shape *sh, struct sk_buff *skb)
+{
+	struct kvec iv = { skb->data, skb->len };
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+
+	return kernel_sendmsg(sh->sock, &msg, &iv, 1, skb->len);
+}
+
+/* Send whatever is due, then sleep until the next frame is */
+static inline void l2shape_work(struct work_struct *work)
+{
+	struct l2shape *sh = container_of(work, struct l2shape, work);
+	struct sk_buff *skb;
+	u64 now = l2shape_now();
+	int err;
+
+	spin_lock_bh(&sh->lock);
+
+	while ((skb = skb_peek(&sh->queue)) && l2shape_cb(skb)->due <= now) {
+		__skb_unlink(skb, &sh->queue);
+		sh->inflight = true;
+		spin_unlock_bh(&sh->lock);
+
+		err = l2shape_xmit(sh, skb);
+
+		spin_lock_bh(&sh->lock);
+		sh->inflight = false;
+
+		/* Back to the head, still counted against the limit */
+		if (err < 0) {
+			__skb_queue_head(&sh->queue, skb);
+			sh->err = err;
+			break;
+		}
+
+		sh->err = 0;
+		sh->queued -= skb->len;
+		kfree_skb(skb);
+	}
+
+	if (sh->err)
+		l2shape_arm(sh, now + L2SHAPE_RETRY);
+	else if (skb)
+		l2shape_arm(sh, l2shape_cb(skb)->due);
+
+	spin_unlock_bh(&sh->lock);
+
+	wake_up(&sh->wait);
+}
+
+static inline void l2shape_init(struct l2shape *sh, struct l2shape_params *p,
+					struct socket *sock)
+{
+	sh->p = p;
+	sh->sock = sock;
+	sh->err = 0;
+	sh->stopped = false;
+
+	spin_lock_init(&sh->lock);
+	skb_queue_head_init(&sh->queue);
+	hrtimer_init(&sh->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	sh->timer.function = l2shape_timeout;
+	INIT_WORK(&sh->work, l2shape_work);
+	init_waitqueue_head(&sh->wait);
+}
+
+/* Before the socket goes away. What is still queued is sent now,
+ * frames the socket refuses this last time are dropped. */
+static inline void l2shape_release(struct l2shape *sh)
+{
+	struct sk_buff *skb;
+
+	/* The work stops arming the timer, then neither can requeue
+	 * the other */
+	spin_lock_bh(&sh->lock);
+	sh->stopped = true;
+	spin_unlock_bh(&sh->lock);
+
+	cancel_work_sync(&sh->work);
+	hrtimer_cancel(&sh->timer);
+	cancel_work_sync(&sh->work);
+
+	while ((skb = skb_dequeue(&sh->queue))) {
+		l2shape_xmit(sh, skb);
+		kfree_skb(skb);
+	}
+
+	sh->queued = 0;
+	sh->err = 0;
+}
+
+/* Drop-in for kernel_sendmsg() on the shaped socket. Like a full L2CAP
+ * socket, it blocks while the emulated link has limit bytes queued. */
+static inline int l2shape_sendmsg(struct l2shape *sh, struct msghdr *msg,
+				struct kvec *iv, size_t num, size_t len)
+{
+	struct l2shape_params *p = sh->p;
+	unsigned int frags = 1, lost = 0;
+	struct sk_buff *skb, *tail;
+	u64 now, due;
+	size_t i;
+	int err;
+
+	/* Like L2CAP does for frames above the outgoing MTU */
+	if (p->mtu && len > p->mtu)
+		return -EMSGSIZE;
+
+	spin_lock_bh(&sh->lock);
+	/* The socket refused the head frame, pass that on so the caller
+	 * backs off or requeues like it would without shaping */
+	err = sh->err;
+	if (err) {
+		spin_unlock_bh(&sh->lock);
+		return err;
+	}
+	if (!l2shape_active(p) && skb_queue_empty(&sh->queue) && !sh->inflight) {
+		spin_unlock_bh(&sh->lock);
+		return kernel_sendmsg(sh->sock, msg, iv, num, len);
+	}
+	spin_unlock_bh(&sh->lock);
+
+	if (p->limit) {
+		err = wait_event_interruptible(sh->wait,
+				ACCESS_ONCE(sh->queued) < p->limit);
+		if (err)
+			return err;
+	}
+
+	skb = alloc_skb(len, GFP_KERNEL);
+	if (!skb)
+		return -ENOMEM;
+
+	for (i = 0; i < num; i++)
+		memcpy(skb_put(skb, iv[i].iov_len), iv[i].iov_base, iv[i].iov_len);
+
+	/* L2CAP header, then baseband packets of seg bytes each */
+	if (p->seg)
+		frags = DIV_ROUND_UP(len + L2SHAPE_L2CAP_HDR, p->seg);
+
+	if (p->loss)
+		for (i = 0; i < frags; i++)
+			if (prandom_u32() % 1000 < p->loss)
+				lost++;
+
+	now = l2shape_now();
+
+	spin_lock_bh(&sh->lock);
+
+	/* One frame on the air at a time, lost packets go again */
+	sh->busy_until = max(sh->busy_until, now) +
+			(u64) lost * p->retrans * NSEC_PER_USEC;
+	if (p->rate)
+		sh->busy_until += div_u64((u64) (len + L2SHAPE_L2CAP_HDR +
+			frags * L2SHAPE_BB_HDR) * NSEC_PER_SEC, p->rate);
+
+	due = sh->busy_until + (u64) p->delay * NSEC_PER_USEC;
+	if (p->jitter)
+		due += (u64) (prandom_u32() % (p->jitter + 1)) * NSEC_PER_USEC;
+
+	/* Jitter must not reorder */
+	tail = skb_peek_tail(&sh->queue);
+	if (tail && due < l2shape_cb(tail)->due)
+		due = l2shape_cb(tail)->due;
+
+	l2shape_cb(skb)->due = due;
+	__skb_queue_tail(&sh->queue, skb);
+	sh->queued += len;
+
+	if (skb_peek(&sh->queue) == skb && !sh->err)
+		l2shape_arm(sh, due);
+
+	spin_unlock_bh(&sh->lock);
+
+	return len;
+}
+
+#endif /* __BT_L2SHAPE_H */
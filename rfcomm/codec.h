@@ -0,0 +1,178 @@
+/*
+   RFCOMM implementation for Linux Bluetooth stack (BlueZ).
+   Copyright (C) 2002 Maxim Krasnyansky <maxk@qualcomm.com>
+   Copyright (C) 2002 Marcel Holtmann <marcel@holtmann.org>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation;
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT OF THIRD PARTY RIGHTS.
+   IN NO EVENT SHALL THE COPYRIGHT HOLDER(S) AND AUTHOR(S) BE LIABLE FOR ANY
+   CLAIM, OR ANY SPECIAL INDIRECT OR CONSEQUENTIAL DAMAGES, OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+   ALL LIABILITY, INCLUDING LIABILITY FOR INFRINGEMENT OF ANY PATENTS,
+   COPYRIGHTS, TRADEMARKS OR OTHER RIGHTS, RELATING TO USE OF THIS
+   SOFTWARE IS DISCLAIMED.
+*/
+
+/*
+ * RFCOMM frame codec.
+ *
+ * Only depends on fcs_computation.h, the frame type constants and a
+ * few sk_buff helpers, so tools/rfcomm can build it in userspace.
+ */
+
+#ifndef __RFCOMM_CODEC_H
+#define __RFCOMM_CODEC_H
+
+#include "fcs_computation.h"
+
+/* Received frame, data and len cover the information field */
+struct rfcomm_frame {
+	u8	addr;
+	u8	ctrl;
+	u8	type;
+	u8	dlci;
+	u8	pf;
+	u8	*data;
+	int	len;
+};
+
+/* MCC message header at the start of a DLCI 0 information field */
+struct rfcomm_mcc_msg {
+	u8	type;
+	u8	cr;
+	u8	len;
+};
+
+/* Address, control and length fields, returns their size */
+static inline int rfcomm_put_hdr(u8 *buf, u8 addr, u8 ctrl, int len)
+{
+	buf[0] = addr;
+	buf[1] = ctrl;
+
+	if (len > 127) {
+		/* __len16(len), little endian */
+		buf[2] = (len << 1) & 0xfe;
+		buf[3] = len >> 7;
+		return 4;
+	}
+
+	buf[2] = __len8(len);
+	return 3;
+}
+
+/* SABM, UA, DISC or DM, always 4 bytes */
+static inline int rfcomm_put_cmd(u8 *buf, u8 addr, u8 type)
+{
+	buf[0] = addr;
+	buf[1] = __ctrl(type, 1);
+	buf[2] = __len8(0);
+	buf[3] = __fcs2(buf);
+	return 4;
+}
+
+/* UIH frame carrying one MCC message, buf needs vlen + 6 bytes.
+ * Returns the frame size. */
+static inline int rfcomm_put_mcc(u8 *buf, u8 addr, int cr, u8 type,
+					const void *val, int vlen)
+{
+	u8 *ptr = buf;
+
+	ptr += rfcomm_put_hdr(ptr, addr, __ctrl(RFCOMM_UIH, 0), vlen + 2);
+
+	*ptr++ = __mcc_type(cr, type);
+	*ptr++ = __len8(vlen);
+
+	if (vlen) {
+		memcpy(ptr, val, vlen);
+		ptr += vlen;
+	}
+
+	*ptr++ = __fcs(buf);
+	return ptr - buf;
+}
+
+/* Credit only UIH frame, always 5 bytes */
+static inline int rfcomm_put_credits(u8 *buf, u8 addr, u8 credits)
+{
+	buf[0] = addr;
+	buf[1] = __ctrl(RFCOMM_UIH, 1);
+	buf[2] = __len8(0);
+	buf[3] = credits;
+	buf[4] = __fcs(buf);
+	return 5;
+}
+
+/* Prepend the UIH header to the payload in skb and return the FCS.
+ * It is appended too, unless the payload is paged and the FCS has to
+ * go out separately. */
+static inline u8 rfcomm_push_uih(struct sk_buff *skb, u8 addr)
+{
+	int len = skb->len;
+	u8 *hdr, fcs;
+
+	hdr = (u8 *) skb_push(skb, len > 127 ? 4 : 3);
+	rfcomm_put_hdr(hdr, addr, __ctrl(RFCOMM_UIH, 0), len);
+
+	fcs = __fcs(hdr);
+
+	if (!skb_is_nonlinear(skb))
+		*(u8 *) skb_put(skb, 1) = fcs;
+
+	return fcs;
+}
+
+/* Parse a received frame of len bytes, FCS included. Returns 0,
+ * -EINVAL if it is truncated or -EILSEQ if the FCS is wrong. */
+static inline int rfcomm_parse_frame(u8 *data, int len, struct rfcomm_frame *f)
+{
+	int hlen, ilen;
+
+	if (len < 4)
+		return -EINVAL;
+
+	if (__test_ea(data[2])) {
+		hlen = 3;
+		ilen = data[2] >> 1;
+	} else {
+		hlen = 4;
+		ilen = (data[2] >> 1) | (data[3] << 7);
+	}
+
+	if (hlen + ilen + 1 > len)
+		return -EINVAL;
+
+	f->addr = data[0];
+	f->ctrl = data[1];
+	f->type = __get_type(f->ctrl);
+	f->dlci = __get_dlci(f->addr);
+	f->pf   = !!__test_pf(f->ctrl);
+
+	if (__check_fcs(data, f->type, data[len - 1]))
+		return -EILSEQ;
+
+	f->data = data + hlen;
+	f->len  = len - hlen - 1;
+	return 0;
+}
+
+/* Returns the size of the MCC header or -EINVAL */
+static inline int rfcomm_parse_mcc(u8 *data, int len, struct rfcomm_mcc_msg *m)
+{
+	if (len < 2)
+		return -EINVAL;
+
+	m->cr   = !!__test_cr(data[0]);
+	m->type = __get_mcc_type(data[0]);
+	m->len  = __get_mcc_len(data[1]);
+	return 2;
+}
+
+#endif /* __RFCOMM_CODEC_H */
@@ -77,56 +77,126 @@ int RFCOMM_CORE::rfcomm_check_security(struct rfcomm_dlc *d)
 	return hci_conn_security(conn->hcon, d->sec_level, auth_type);
 }
 
-void RFCOMM_CORE::rfcomm_session_timeout_cls(unsigned long arg)
+/* ---- RFCOMM timeout wheel ---- */
+void RFCOMM_CORE::rfcomm_tmo_set(struct rfcomm_tmo *t, long timeout)
 {
-	struct rfcomm_session *s = (struct rfcomm_session *) arg;
+	struct rfcomm_wheel *w = &rfcomm_wheel;
+	unsigned long expires = jiffies + timeout;
 
-	BT_DBG("session %p state %ld", s, s->state);
+	spin_lock_bh(&w->lock);
 
-	set_bit(RFCOMM_TIMED_OUT, &s->flags);
-	rfcomm_schedule();
+	if (list_empty(&t->list))
+		w->count++;
+	else
+		list_del(&t->list);
+
+	/* The slot of the first tick at or after expiry */
+	t->expires = expires;
+	list_add_tail(&t->list, &w->slot[(rfcomm_wheel_tick(expires) + 1) %
+						RFCOMM_WHEEL_SLOTS]);
+
+	spin_unlock_bh(&w->lock);
+
+	/* krfcommd may be sleeping past the new deadline, it works out
+	 * the sleep again itself after each pass */
+	if (current != rfcomm_thread)
+		rfcomm_schedule();
 }
 
-void RFCOMM_CORE::rfcomm_session_set_timer(struct rfcomm_session *s, long timeout)
+void RFCOMM_CORE::rfcomm_tmo_clear(struct rfcomm_tmo *t)
 {
-	BT_DBG("session %p state %ld timeout %ld", s, s->state, timeout);
+	struct rfcomm_wheel *w = &rfcomm_wheel;
+
+	/* Always under the lock, the run may be about to flag it */
+	spin_lock_bh(&w->lock);
+
+	if (!list_empty(&t->list)) {
+		list_del_init(&t->list);
+		w->count--;
+	}
 
-	mod_timer(&s->timer, jiffies + timeout);
+	spin_unlock_bh(&w->lock);
 }
 
-void RFCOMM_CORE::rfcomm_session_clear_timer(struct rfcomm_session *s)
+void RFCOMM_CORE::rfcomm_wheel_run(void)
 {
-	BT_DBG("session %p state %ld", s, s->state);
+	struct rfcomm_wheel *w = &rfcomm_wheel;
+	unsigned long now = jiffies, tick = rfcomm_wheel_tick(now);
+	struct rfcomm_tmo *t, *n;
+	unsigned long i;
+
+	spin_lock_bh(&w->lock);
+
+	i = min_t(unsigned long, tick - w->clock, RFCOMM_WHEEL_SLOTS);
+	w->clock = tick;
+
+	while (w->count && i--) {
+		struct list_head *slot = &w->slot[(tick - i) % RFCOMM_WHEEL_SLOTS];
+
+		list_for_each_entry_safe(t, n, slot, list) {
+			/* Due in a later round */
+			if (time_before(now, t->expires))
+				continue;
+
+			list_del_init(&t->list);
+			w->count--;
+
+			set_bit(RFCOMM_TIMED_OUT, t->flags);
+		}
+	}
 
-	del_timer_sync(&s->timer);
+	spin_unlock_bh(&w->lock);
 }
 
-/* ---- RFCOMM DLCs ---- */
-void RFCOMM_CORE::rfcomm_dlc_timeout_cls(unsigned long arg)
+long RFCOMM_CORE::rfcomm_wheel_timeout(void)
 {
-	struct rfcomm_dlc *d = (struct rfcomm_dlc*) arg;
+	struct rfcomm_wheel *w = &rfcomm_wheel;
+	unsigned long now = jiffies, tick = rfcomm_wheel_tick(now);
+	unsigned long i;
 
-	BT_DBG("dlc %p state %ld", d, d->state);
+	spin_lock_bh(&w->lock);
 
-	set_bit(RFCOMM_TIMED_OUT, &d->flags);
-	rfcomm_dlc_put(d);
-	rfcomm_schedule();
+	if (!w->count) {
+		spin_unlock_bh(&w->lock);
+		return MAX_SCHEDULE_TIMEOUT;
+	}
+
+	for (i = 1; i < RFCOMM_WHEEL_SLOTS; i++)
+		if (!list_empty(&w->slot[(tick + i) % RFCOMM_WHEEL_SLOTS]))
+			break;
+
+	spin_unlock_bh(&w->lock);
+
+	return i * RFCOMM_WHEEL_TICK - (now - INITIAL_JIFFIES) % RFCOMM_WHEEL_TICK;
+}
+
+void RFCOMM_CORE::rfcomm_session_set_timer(struct rfcomm_session *s, long timeout)
+{
+	BT_DBG("session %p state %ld timeout %ld", s, s->state, timeout);
+
+	rfcomm_tmo_set(rfcomm_session_tmo(s), timeout);
+}
+
+void RFCOMM_CORE::rfcomm_session_clear_timer(struct rfcomm_session *s)
+{
+	BT_DBG("session %p state %ld", s, s->state);
+
+	rfcomm_tmo_clear(rfcomm_session_tmo(s));
 }
 
+/* ---- RFCOMM DLCs ---- */
 void RFCOMM_CORE::rfcomm_dlc_set_timer(struct rfcomm_dlc *d, long timeout)
 {
 	BT_DBG("dlc %p state %ld timeout %ld", d, d->state, timeout);
 
-	if (!mod_timer(&d->timer, jiffies + timeout))
-		rfcomm_dlc_hold(d);
+	rfcomm_tmo_set(&rfcomm_dlc_ext(d)->tmo, timeout);
 }
 
 void RFCOMM_CORE::rfcomm_dlc_clear_timer(struct rfcomm_dlc *d)
 {
 	BT_DBG("dlc %p state %ld", d, d->state);
 
-	if (del_timer(&d->timer))
-		rfcomm_dlc_put(d);
+	rfcomm_tmo_clear(&rfcomm_dlc_ext(d)->tmo);
 }
 
 void RFCOMM_CORE::rfcomm_dlc_clear_state(struct rfcomm_dlc *d)
@@ -144,17 +214,39 @@ void RFCOMM_CORE::rfcomm_dlc_clear_state(struct rfcomm_dlc *d)
 	d->rx_credits = RFCOMM_DEFAULT_CREDITS;
 }
 
+void RFCOMM_CORE::rfcomm_dlc_ctor_cls(void *obj)
+{
+	struct rfcomm_dlc_ext *e = (struct rfcomm_dlc_ext *) obj;
+
+	INIT_LIST_HEAD(&e->tmo.list);
+	e->tmo.flags = &e->d.flags;
+
+	skb_queue_head_init(&e->d.tx_queue);
+	spin_lock_init(&e->d.lock);
+}
+
 struct rfcomm_dlc* RFCOMM_CORE::rfcomm_dlc_alloc_cls(gfp_t prio)
 {
-	struct rfcomm_dlc *d = kzalloc(sizeof(*d), prio);
+	struct rfcomm_dlc *d;
 
+	/* Everything from state on is cleared, what comes before it
+	 * is either constructed or set on link. */
+	BUILD_BUG_ON(offsetof(struct rfcomm_dlc, lock) >
+				offsetof(struct rfcomm_dlc, state));
+
+	d = (struct rfcomm_dlc *) kmem_cache_alloc(rfcomm_dlc_cache, prio);
 	if (!d)
 		return NULL;
 
-	setup_timer(&d->timer, rfcomm_dlc_timeout, (unsigned long)d);
+	INIT_LIST_HEAD(&d->list);
+	d->session = NULL;
+	memset(&d->state, 0, sizeof(*d) - offsetof(struct rfcomm_dlc, state));
+	memset(&rfcomm_dlc_ext(d)->tmo + 1, 0, sizeof(struct rfcomm_dlc_ext) -
+				offsetof(struct rfcomm_dlc_ext, tmo) -
+				sizeof(struct rfcomm_tmo));
+
+	rfcomm_dlc_ext(d)->rx_credits_max = -1;
 
-	skb_queue_head_init(&d->tx_queue);
-	spin_lock_init(&d->lock);
 	atomic_set(&d->refcnt, 1);
 
 	rfcomm_dlc_clear_state(d);
@@ -168,8 +260,9 @@ void RFCOMM_CORE::rfcomm_dlc_free(struct rfcomm_dlc *d)
 {
 	BT_DBG("%p", d);
 
+	rfcomm_dlc_clear_timer(d);
 	skb_queue_purge(&d->tx_queue);
-	kfree(d);
+	kmem_cache_free(rfcomm_dlc_cache, d);
 }
 
 void RFCOMM_CORE::rfcomm_dlc_link(struct rfcomm_session *s, struct rfcomm_dlc *d)
@@ -294,11 +387,18 @@ int RFCOMM_CORE::__rfcomm_dlc_close(struct rfcomm_dlc *d, int err)
 
 	case BT_CONNECTED:
 		d->state = BT_DISCONN;
+
+		/* An error close is an abort, what is still queued goes */
+		if (err)
+			skb_queue_purge(&d->tx_queue);
+
 		if (skb_queue_empty(&d->tx_queue)) {
 			rfcomm_send_disc(s, d->dlci);
 			rfcomm_dlc_set_timer(d, RFCOMM_DISC_TIMEOUT);
 		} else {
-			rfcomm_queue_disc(d);
+			/* Sent by rfcomm_process_tx() after the data */
+			set_bit(RFCOMM_DISC_PENDING, &d->flags);
+			rfcomm_schedule();
 			rfcomm_dlc_set_timer(d, RFCOMM_DISC_TIMEOUT * 2);
 		}
 		break;
@@ -403,6 +503,21 @@ void RFCOMM_CORE::__rfcomm_dlc_unthrottle(struct rfcomm_dlc *d)
 	rfcomm_schedule();
 }
 
+/* Limit the credits handed out by rfcomm_process_tx() to what fits
+ * into the owner's free receive space. */
+void RFCOMM_CORE::rfcomm_dlc_set_rx_space(struct rfcomm_dlc *d, int space)
+{
+	struct rfcomm_dlc_ext *ext = rfcomm_dlc_ext(d);
+	int max = space > 0 ? space / d->mtu : 0;
+	int old = ext->rx_credits_max;
+
+	ext->rx_credits_max = max;
+
+	/* Only wake krfcommd if more credits can be granted now */
+	if (d->cfc && max > old && d->rx_credits <= (min_t(int, max, d->cfc) >> 2))
+		rfcomm_schedule();
+}
+
 /*
    Set/get modem status functions use _local_ status i.e. what we report
    to the other side.
@@ -436,20 +551,38 @@ int RFCOMM_CORE::rfcomm_dlc_get_modem_status(struct rfcomm_dlc *d, u8 *v24_sig)
 }
 
 /* ---- RFCOMM sessions ---- */
+void RFCOMM_CORE::rfcomm_session_ctor_cls(void *obj)
+{
+	struct rfcomm_session_ext *se = (struct rfcomm_session_ext *) obj;
+
+	INIT_LIST_HEAD(&se->tmo.list);
+	se->tmo.flags = &se->s.flags;
+
+	skb_queue_head_init(&se->ctrl_queue);
+}
+
 struct rfcomm_session* RFCOMM_CORE::rfcomm_session_add(struct socket *sock, int state)
 {
-	struct rfcomm_session *s = kzalloc(sizeof(*s), GFP_KERNEL);
+	struct rfcomm_session_ext *se;
+	struct rfcomm_session *s;
 
-	if (!s)
+	se = (struct rfcomm_session_ext *) kmem_cache_alloc(rfcomm_session_cache,
+								GFP_KERNEL);
+	if (!se)
 		return NULL;
 
+	s = &se->s;
+
 	BT_DBG("session %p sock %p", s, sock);
 
-	setup_timer(&s->timer, rfcomm_session_timeout, (unsigned long) s);
+	memset(&s->state, 0, sizeof(*s) - offsetof(struct rfcomm_session, state));
+	memset(&se->ctrl, 0, sizeof(*se) -
+				offsetof(struct rfcomm_session_ext, ctrl));
 
 	INIT_LIST_HEAD(&s->dlcs);
 	s->state = state;
 	s->sock  = sock;
+	l2shape_init(&se->shape, &shape_params, sock);
 
 	s->mtu = RFCOMM_DEFAULT_MTU;
 	s->cfc = disable_cfc ? RFCOMM_CFC_DISABLED : RFCOMM_CFC_UNKNOWN;
@@ -458,7 +591,7 @@ struct rfcomm_session* RFCOMM_CORE::rfcomm_session_add(struct socket *sock, int
 	 * Otherwise we won't be able to unload the module. */
 	if (state != BT_LISTEN)
 		if (!try_module_get(THIS_MODULE)) {
-			kfree(s);
+			kmem_cache_free(rfcomm_session_cache, se);
 			return NULL;
 		}
 
@@ -476,8 +609,15 @@ struct rfcomm_session* RFCOMM_CORE::rfcomm_session_del(struct rfcomm_session *s)
 	list_del(&s->list);
 
 	rfcomm_session_clear_timer(s);
+
+	/* Last try for pending control frames, the rest is dropped */
+	rfcomm_process_ctrl(s);
+	skb_queue_purge(rfcomm_session_ctrl_queue(s));
+
+	l2shape_release(rfcomm_session_shape(s));
 	sock_release(s->sock);
-	kfree(s);
+	kmem_cache_free(rfcomm_session_cache,
+			container_of(s, struct rfcomm_session_ext, s));
 
 	if (state != BT_LISTEN)
 		module_put(THIS_MODULE);
@@ -588,7 +728,7 @@ void RFCOMM_CORE::rfcomm_session_getaddr(struct rfcomm_session *s, bdaddr_t *src
 }
 
 /* ---- RFCOMM frame sending ---- */
-int RFCOMM_CORE::rfcomm_send_frame(struct rfcomm_session *s, u8 *data, int len)
+int RFCOMM_CORE::rfcomm_xmit_frame(struct rfcomm_session *s, u8 *data, int len)
 {
 	struct kvec iv = { data, len };
 	struct msghdr msg;
@@ -597,7 +737,107 @@ int RFCOMM_CORE::rfcomm_send_frame(struct rfcomm_session *s, u8 *data, int len)
 
 	memset(&msg, 0, sizeof(msg));
 
-	return kernel_sendmsg(s->sock, &msg, &iv, 1, len);
+	return l2shape_sendmsg(rfcomm_session_shape(s), &msg, &iv, 1, len);
+}
+
+int RFCOMM_CORE::rfcomm_send_skb(struct rfcomm_session *s, struct sk_buff *skb)
+{
+	struct kvec iv[MAX_SKB_FRAGS + 2];
+	struct msghdr msg;
+	int i, n = 0, err;
+
+	if (!skb_is_nonlinear(skb))
+		return rfcomm_xmit_frame(s, skb->data, skb->len);
+
+	BT_DBG("session %p len %d frags %d", s, skb->len,
+			skb_shinfo(skb)->nr_frags);
+
+	/* Header, payload straight from the pages, FCS */
+	iv[n].iov_base = skb->data;
+	iv[n++].iov_len = skb_headlen(skb);
+
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+		const skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+
+		iv[n].iov_base = (u8 *) kmap(skb_frag_page(frag)) + frag->page_offset;
+		iv[n++].iov_len = skb_frag_size(frag);
+	}
+
+	iv[n].iov_base = &rfcomm_skb_cb(skb)->fcs;
+	iv[n++].iov_len = 1;
+
+	memset(&msg, 0, sizeof(msg));
+
+	err = l2shape_sendmsg(rfcomm_session_shape(s), &msg, iv, n, skb->len + 1);
+
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
+		kunmap(skb_frag_page(&skb_shinfo(skb)->frags[i]));
+
+	return err;
+}
+
+int RFCOMM_CORE::rfcomm_send_frame(struct rfcomm_session *s, u8 *data, int len)
+{
+	struct sk_buff *skb;
+
+	BT_DBG("session %p len %d", s, len);
+
+	skb = alloc_skb(len, GFP_KERNEL);
+	if (!skb)
+		return -ENOMEM;
+
+	memcpy(__skb_put(skb, len), data, len);
+	skb_queue_tail(rfcomm_session_ctrl_queue(s), skb);
+
+	rfcomm_process_ctrl(s);
+	return 0;
+}
+
+int RFCOMM_CORE::rfcomm_process_ctrl(struct rfcomm_session *s)
+{
+	struct sk_buff_head *q = rfcomm_session_ctrl_queue(s);
+	struct rfcomm_ctrl *c = rfcomm_session_ctrl(s);
+	struct sk_buff *skb;
+	int err = 0;
+
+	/* One sender at a time keeps the frames in order. Whoever holds
+	 * the lane looks again after letting go, so nothing is stranded
+	 * by a frame queued just before that. */
+	while (err >= 0 && !skb_queue_empty(q) && !test_and_set_bit(0, &c->busy)) {
+		while ((skb = skb_dequeue(q))) {
+			err = rfcomm_xmit_frame(s, skb->data, skb->len);
+			if (err < 0) {
+				c->retries++;
+				if (++c->attempts < RFCOMM_CTRL_RETRIES) {
+					skb_queue_head(q, skb);
+					break;
+				}
+
+				/* Don't let it hold up the rest for good */
+				c->dropped++;
+				err = 0;
+			} else {
+				c->sent++;
+				c->bytes += skb->len;
+			}
+
+			c->attempts = 0;
+			kfree_skb(skb);
+		}
+
+		clear_bit(0, &c->busy);
+	}
+
+	if (err < 0) {
+		/* Nothing else may wake krfcommd for it */
+		rfcomm_ctrl_retry = true;
+		if (current != rfcomm_thread)
+			rfcomm_schedule();
+	}
+
+	BT_DBG("session %p err %d qlen %d", s, err, skb_queue_len(q));
+
+	return skb_queue_len(q);
 }
 
 int RFCOMM_CORE::rfcomm_send_cmd(struct rfcomm_session *s, struct rfcomm_cmd *cmd)
@@ -613,10 +853,7 @@ int RFCOMM_CORE::rfcomm_send_sabm(struct rfcomm_session *s, u8 dlci)
 
 	BT_DBG("%p dlci %d", s, dlci);
 
-	cmd.addr = __addr(s->initiator, dlci);
-	cmd.ctrl = __ctrl(RFCOMM_SABM, 1);
-	cmd.len  = __len8(0);
-	cmd.fcs  = __fcs2((u8 *) &cmd);
+	rfcomm_put_cmd((u8 *) &cmd, __addr(s->initiator, dlci), RFCOMM_SABM);
 
 	return rfcomm_send_cmd(s, &cmd);
 }
@@ -627,10 +864,7 @@ int RFCOMM_CORE::rfcomm_send_ua(struct rfcomm_session *s, u8 dlci)
 
 	BT_DBG("%p dlci %d", s, dlci);
 
-	cmd.addr = __addr(!s->initiator, dlci);
-	cmd.ctrl = __ctrl(RFCOMM_UA, 1);
-	cmd.len  = __len8(0);
-	cmd.fcs  = __fcs2((u8 *) &cmd);
+	rfcomm_put_cmd((u8 *) &cmd, __addr(!s->initiator, dlci), RFCOMM_UA);
 
 	return rfcomm_send_cmd(s, &cmd);
 }
@@ -641,94 +875,42 @@ int RFCOMM_CORE::rfcomm_send_disc(struct rfcomm_session *s, u8 dlci)
 
 	BT_DBG("%p dlci %d", s, dlci);
 
-	cmd.addr = __addr(s->initiator, dlci);
-	cmd.ctrl = __ctrl(RFCOMM_DISC, 1);
-	cmd.len  = __len8(0);
-	cmd.fcs  = __fcs2((u8 *) &cmd);
+	rfcomm_put_cmd((u8 *) &cmd, __addr(s->initiator, dlci), RFCOMM_DISC);
 
 	return rfcomm_send_cmd(s, &cmd);
 }
 
-int RFCOMM_CORE::rfcomm_queue_disc(struct rfcomm_dlc *d)
-{
-	struct rfcomm_cmd *cmd;
-	struct sk_buff *skb;
-
-	BT_DBG("dlc %p dlci %d", d, d->dlci);
-
-	skb = alloc_skb(sizeof(*cmd), GFP_KERNEL);
-	if (!skb)
-		return -ENOMEM;
-
-	cmd = (struct rfcomm_cmd *) __skb_put(skb, sizeof(*cmd));
-	cmd->addr = d->addr;
-	cmd->ctrl = __ctrl(RFCOMM_DISC, 1);
-	cmd->len  = __len8(0);
-	cmd->fcs  = __fcs2((u8 *) cmd);
-
-	skb_queue_tail(&d->tx_queue, skb);
-	rfcomm_schedule();
-	return 0;
-}
-
 int RFCOMM_CORE::rfcomm_send_dm(struct rfcomm_session *s, u8 dlci)
 {
 	struct rfcomm_cmd cmd;
 
 	BT_DBG("%p dlci %d", s, dlci);
 
-	cmd.addr = __addr(!s->initiator, dlci);
-	cmd.ctrl = __ctrl(RFCOMM_DM, 1);
-	cmd.len  = __len8(0);
-	cmd.fcs  = __fcs2((u8 *) &cmd);
+	rfcomm_put_cmd((u8 *) &cmd, __addr(!s->initiator, dlci), RFCOMM_DM);
 
 	return rfcomm_send_cmd(s, &cmd);
 }
 
 int RFCOMM_CORE::rfcomm_send_nsc(struct rfcomm_session *s, int cr, u8 type)
 {
-	struct rfcomm_hdr *hdr;
-	struct rfcomm_mcc *mcc;
-	u8 buf[16], *ptr = buf;
+	u8 buf[16], nsc;
 
 	BT_DBG("%p cr %d type %d", s, cr, type);
 
-	hdr = (struct rfcomm_hdr *) ptr; ptr += sizeof(*hdr);
-	hdr->addr = __addr(s->initiator, 0);
-	hdr->ctrl = __ctrl(RFCOMM_UIH, 0);
-	hdr->len  = __len8(sizeof(*mcc) + 1);
-
-	mcc = (struct rfcomm_mcc *) ptr; ptr += sizeof(*mcc);
-	mcc->type = __mcc_type(cr, RFCOMM_NSC);
-	mcc->len  = __len8(1);
-
 	/* Type that we didn't like */
-	*ptr = __mcc_type(cr, type); ptr++;
+	nsc = __mcc_type(cr, type);
 
-	*ptr = __fcs(buf); ptr++;
-
-	return rfcomm_send_frame(s, buf, ptr - buf);
+	return rfcomm_send_frame(s, buf, rfcomm_put_mcc(buf,
+			__addr(s->initiator, 0), cr, RFCOMM_NSC, &nsc, 1));
 }
 
 int RFCOMM_CORE::rfcomm_send_pn(struct rfcomm_session *s, int cr, struct rfcomm_dlc *d)
 {
-	struct rfcomm_hdr *hdr;
-	struct rfcomm_mcc *mcc;
-	struct rfcomm_pn  *pn;
-	u8 buf[16], *ptr = buf;
+	struct rfcomm_pn pn_buf, *pn = &pn_buf;
+	u8 buf[16];
 
 	BT_DBG("%p cr %d dlci %d mtu %d", s, cr, d->dlci, d->mtu);
 
-	hdr = (struct rfcomm_hdr *) ptr; ptr += sizeof(*hdr);
-	hdr->addr = __addr(s->initiator, 0);
-	hdr->ctrl = __ctrl(RFCOMM_UIH, 0);
-	hdr->len  = __len8(sizeof(*mcc) + sizeof(*pn));
-
-	mcc = (struct rfcomm_mcc *) ptr; ptr += sizeof(*mcc);
-	mcc->type = __mcc_type(cr, RFCOMM_PN);
-	mcc->len  = __len8(sizeof(*pn));
-
-	pn = (struct rfcomm_pn *) ptr; ptr += sizeof(*pn);
 	pn->dlci        = d->dlci;
 	pn->priority    = d->priority;
 	pn->ack_timer   = 0;
@@ -747,9 +929,8 @@ int RFCOMM_CORE::rfcomm_send_pn(struct rfcomm_session *s, int cr, struct rfcomm_
 	else
 		pn->mtu = cpu_to_le16(d->mtu);
 
-	*ptr = __fcs(buf); ptr++;
-
-	return rfcomm_send_frame(s, buf, ptr - buf);
+	return rfcomm_send_frame(s, buf, rfcomm_put_mcc(buf,
+			__addr(s->initiator, 0), cr, RFCOMM_PN, pn, sizeof(*pn)));
 }
 
 int RFCOMM_CORE::rfcomm_send_rpn(struct rfcomm_session *s, int cr, u8 dlci,
@@ -757,26 +938,14 @@ int RFCOMM_CORE::rfcomm_send_rpn(struct rfcomm_session *s, int cr, u8 dlci,
 			u8 parity, u8 flow_ctrl_settings,
 			u8 xon_char, u8 xoff_char, u16 param_mask)
 {
-	struct rfcomm_hdr *hdr;
-	struct rfcomm_mcc *mcc;
-	struct rfcomm_rpn *rpn;
-	u8 buf[16], *ptr = buf;
+	struct rfcomm_rpn rpn_buf, *rpn = &rpn_buf;
+	u8 buf[16];
 
 	BT_DBG("%p cr %d dlci %d bit_r 0x%x data_b 0x%x stop_b 0x%x parity 0x%x"
 			" flwc_s 0x%x xon_c 0x%x xoff_c 0x%x p_mask 0x%x",
 		s, cr, dlci, bit_rate, data_bits, stop_bits, parity,
 		flow_ctrl_settings, xon_char, xoff_char, param_mask);
 
-	hdr = (struct rfcomm_hdr *) ptr; ptr += sizeof(*hdr);
-	hdr->addr = __addr(s->initiator, 0);
-	hdr->ctrl = __ctrl(RFCOMM_UIH, 0);
-	hdr->len  = __len8(sizeof(*mcc) + sizeof(*rpn));
-
-	mcc = (struct rfcomm_mcc *) ptr; ptr += sizeof(*mcc);
-	mcc->type = __mcc_type(cr, RFCOMM_RPN);
-	mcc->len  = __len8(sizeof(*rpn));
-
-	rpn = (struct rfcomm_rpn *) ptr; ptr += sizeof(*rpn);
 	rpn->dlci          = __addr(1, dlci);
 	rpn->bit_rate      = bit_rate;
 	rpn->line_settings = __rpn_line_settings(data_bits, stop_bits, parity);
@@ -785,178 +954,175 @@ int RFCOMM_CORE::rfcomm_send_rpn(struct rfcomm_session *s, int cr, u8 dlci,
 	rpn->xoff_char     = xoff_char;
 	rpn->param_mask    = cpu_to_le16(param_mask);
 
-	*ptr = __fcs(buf); ptr++;
-
-	return rfcomm_send_frame(s, buf, ptr - buf);
+	return rfcomm_send_frame(s, buf, rfcomm_put_mcc(buf,
+			__addr(s->initiator, 0), cr, RFCOMM_RPN, rpn, sizeof(*rpn)));
 }
 
 int RFCOMM_CORE::rfcomm_send_rls(struct rfcomm_session *s, int cr, u8 dlci, u8 status)
 {
-	struct rfcomm_hdr *hdr;
-	struct rfcomm_mcc *mcc;
-	struct rfcomm_rls *rls;
-	u8 buf[16], *ptr = buf;
+	struct rfcomm_rls rls_buf, *rls = &rls_buf;
+	u8 buf[16];
 
 	BT_DBG("%p cr %d status 0x%x", s, cr, status);
 
-	hdr = (struct rfcomm_hdr *) ptr; ptr += sizeof(*hdr);
-	hdr->addr = __addr(s->initiator, 0);
-	hdr->ctrl = __ctrl(RFCOMM_UIH, 0);
-	hdr->len  = __len8(sizeof(*mcc) + sizeof(*rls));
-
-	mcc = (struct rfcomm_mcc *) ptr; ptr += sizeof(*mcc);
-	mcc->type = __mcc_type(cr, RFCOMM_RLS);
-	mcc->len  = __len8(sizeof(*rls));
-
-	rls = (struct rfcomm_rls *) ptr; ptr += sizeof(*rls);
 	rls->dlci   = __addr(1, dlci);
 	rls->status = status;
 
-	*ptr = __fcs(buf); ptr++;
-
-	return rfcomm_send_frame(s, buf, ptr - buf);
+	return rfcomm_send_frame(s, buf, rfcomm_put_mcc(buf,
+			__addr(s->initiator, 0), cr, RFCOMM_RLS, rls, sizeof(*rls)));
 }
 
 int RFCOMM_CORE::rfcomm_send_msc(struct rfcomm_session *s, int cr, u8 dlci, u8 v24_sig)
 {
-	struct rfcomm_hdr *hdr;
-	struct rfcomm_mcc *mcc;
-	struct rfcomm_msc *msc;
-	u8 buf[16], *ptr = buf;
+	struct rfcomm_msc msc_buf, *msc = &msc_buf;
+	u8 buf[16];
 
 	BT_DBG("%p cr %d v24 0x%x", s, cr, v24_sig);
 
-	hdr = (struct rfcomm_hdr *) ptr; ptr += sizeof(*hdr);
-	hdr->addr = __addr(s->initiator, 0);
-	hdr->ctrl = __ctrl(RFCOMM_UIH, 0);
-	hdr->len  = __len8(sizeof(*mcc) + sizeof(*msc));
-
-	mcc = (struct rfcomm_mcc *) ptr; ptr += sizeof(*mcc);
-	mcc->type = __mcc_type(cr, RFCOMM_MSC);
-	mcc->len  = __len8(sizeof(*msc));
-
-	msc = (struct rfcomm_msc *) ptr; ptr += sizeof(*msc);
 	msc->dlci    = __addr(1, dlci);
 	msc->v24_sig = v24_sig | 0x01;
 
-	*ptr = __fcs(buf); ptr++;
-
-	return rfcomm_send_frame(s, buf, ptr - buf);
+	return rfcomm_send_frame(s, buf, rfcomm_put_mcc(buf,
+			__addr(s->initiator, 0), cr, RFCOMM_MSC, msc, sizeof(*msc)));
 }
 
 int RFCOMM_CORE::rfcomm_send_fcoff(struct rfcomm_session *s, int cr)
 {
-	struct rfcomm_hdr *hdr;
-	struct rfcomm_mcc *mcc;
-	u8 buf[16], *ptr = buf;
+	u8 buf[16];
 
 	BT_DBG("%p cr %d", s, cr);
 
-	hdr = (struct rfcomm_hdr *) ptr; ptr += sizeof(*hdr);
-	hdr->addr = __addr(s->initiator, 0);
-	hdr->ctrl = __ctrl(RFCOMM_UIH, 0);
-	hdr->len  = __len8(sizeof(*mcc));
-
-	mcc = (struct rfcomm_mcc *) ptr; ptr += sizeof(*mcc);
-	mcc->type = __mcc_type(cr, RFCOMM_FCOFF);
-	mcc->len  = __len8(0);
-
-	*ptr = __fcs(buf); ptr++;
-
-	return rfcomm_send_frame(s, buf, ptr - buf);
+	return rfcomm_send_frame(s, buf, rfcomm_put_mcc(buf,
+			__addr(s->initiator, 0), cr, RFCOMM_FCOFF, NULL, 0));
 }
 
 int RFCOMM_CORE::rfcomm_send_fcon(struct rfcomm_session *s, int cr)
 {
-	struct rfcomm_hdr *hdr;
-	struct rfcomm_mcc *mcc;
-	u8 buf[16], *ptr = buf;
+	u8 buf[16];
 
 	BT_DBG("%p cr %d", s, cr);
 
-	hdr = (struct rfcomm_hdr *) ptr; ptr += sizeof(*hdr);
-	hdr->addr = __addr(s->initiator, 0);
-	hdr->ctrl = __ctrl(RFCOMM_UIH, 0);
-	hdr->len  = __len8(sizeof(*mcc));
-
-	mcc = (struct rfcomm_mcc *) ptr; ptr += sizeof(*mcc);
-	mcc->type = __mcc_type(cr, RFCOMM_FCON);
-	mcc->len  = __len8(0);
-
-	*ptr = __fcs(buf); ptr++;
-
-	return rfcomm_send_frame(s, buf, ptr - buf);
+	return rfcomm_send_frame(s, buf, rfcomm_put_mcc(buf,
+			__addr(s->initiator, 0), cr, RFCOMM_FCON, NULL, 0));
 }
 
 int RFCOMM_CORE::rfcomm_send_test(struct rfcomm_session *s, int cr, u8 *pattern, int len)
 {
-	struct socket *sock = s->sock;
-	struct kvec iv[3];
-	struct msghdr msg;
-	unsigned char hdr[5], crc[1];
+	u8 buf[RFCOMM_PROBE_MAX_LEN + 8];
 
-	if (len > 125)
+	if (len > RFCOMM_PROBE_MAX_LEN)
 		return -EINVAL;
 
 	BT_DBG("%p cr %d", s, cr);
 
-	hdr[0] = __addr(s->initiator, 0);
-	hdr[1] = __ctrl(RFCOMM_UIH, 0);
-	hdr[2] = 0x01 | ((len + 2) << 1);
-	hdr[3] = 0x01 | ((cr & 0x01) << 1) | (RFCOMM_TEST << 2);
-	hdr[4] = 0x01 | (len << 1);
+	return rfcomm_send_frame(s, buf, rfcomm_put_mcc(buf,
+			__addr(s->initiator, 0), cr, RFCOMM_TEST, pattern, len));
+}
 
-	crc[0] = __fcs(hdr);
+int RFCOMM_CORE::rfcomm_send_credits(struct rfcomm_session *s, u8 addr, u8 credits)
+{
+	u8 buf[16];
 
-	iv[0].iov_base = hdr;
-	iv[0].iov_len  = 5;
-	iv[1].iov_base = pattern;
-	iv[1].iov_len  = len;
-	iv[2].iov_base = crc;
-	iv[2].iov_len  = 1;
+	BT_DBG("%p addr %d credits %d", s, addr, credits);
 
-	memset(&msg, 0, sizeof(msg));
+	return rfcomm_send_frame(s, buf, rfcomm_put_credits(buf, addr, credits));
+}
+
+void RFCOMM_CORE::rfcomm_make_uih(struct sk_buff *skb, u8 addr)
+{
+	u8 fcs = rfcomm_push_uih(skb, addr);
 
-	return kernel_sendmsg(sock, &msg, iv, 3, 6 + len);
+	/* Sent after the pages by rfcomm_send_skb() */
+	if (skb_is_nonlinear(skb))
+		rfcomm_skb_cb(skb)->fcs = fcs;
 }
 
-int RFCOMM_CORE::rfcomm_send_credits(struct rfcomm_session *s, u8 addr, u8 credits)
+/* ---- RFCOMM link probe ---- */
+void RFCOMM_CORE::rfcomm_probe_start(struct rfcomm_session *s, u32 count, u8 len)
 {
-	struct rfcomm_hdr *hdr;
-	u8 buf[16], *ptr = buf;
+	struct rfcomm_probe *p = rfcomm_session_probe(s);
 
-	BT_DBG("%p addr %d credits %d", s, addr, credits);
+	BT_DBG("session %p count %u len %u", s, count, len);
+
+	memset(p, 0, sizeof(*p));
+	p->count   = count;
+	p->len     = len;
+	p->rtt_min = S64_MAX;
+	p->state   = RFCOMM_PROBE_RUNNING;
+}
 
-	hdr = (struct rfcomm_hdr *) ptr; ptr += sizeof(*hdr);
-	hdr->addr = addr;
-	hdr->ctrl = __ctrl(RFCOMM_UIH, 1);
-	hdr->len  = __len8(0);
+void RFCOMM_CORE::rfcomm_probe_send(struct rfcomm_session *s)
+{
+	struct rfcomm_probe *p = rfcomm_session_probe(s);
+	u8 pattern[RFCOMM_PROBE_MAX_LEN];
+	ktime_t now;
+	int i;
 
-	*ptr = credits; ptr++;
+	if (p->state != RFCOMM_PROBE_RUNNING || s->state != BT_CONNECTED)
+		return;
 
-	*ptr = __fcs(buf); ptr++;
+	while (p->sent < p->count &&
+			p->sent - p->received < RFCOMM_PROBE_WINDOW) {
+		now = ktime_get();
 
-	return rfcomm_send_frame(s, buf, ptr - buf);
+		put_unaligned_le32(p->sent, pattern);
+		put_unaligned_le64(ktime_to_ns(now), pattern + 4);
+		for (i = RFCOMM_PROBE_HDR_LEN; i < p->len; i++)
+			pattern[i] = (u8) (p->sent + i);
+
+		if (rfcomm_send_test(s, 1, pattern, p->len) < 0)
+			break;
+
+		if (!p->sent)
+			p->start = now;
+		p->sent++;
+	}
 }
 
-void RFCOMM_CORE::rfcomm_make_uih(struct sk_buff *skb, u8 addr)
+void RFCOMM_CORE::rfcomm_probe_recv(struct rfcomm_session *s, struct sk_buff *skb)
 {
-	struct rfcomm_hdr *hdr;
-	int len = skb->len;
-	u8 *crc;
+	struct rfcomm_probe *p = rfcomm_session_probe(s);
+	ktime_t now = ktime_get();
+	s64 rtt;
+	u32 seq;
+	int i;
 
-	if (len > 127) {
-		hdr = (struct rfcomm_hdr *) skb_push(skb, 4);
-		put_unaligned(cpu_to_le16(__len16(len)), (__le16 *) &hdr->len);
-	} else {
-		hdr = (struct rfcomm_hdr *) skb_push(skb, 3);
-		hdr->len = __len8(len);
+	if (p->state != RFCOMM_PROBE_RUNNING)
+		return;
+
+	BT_DBG("session %p len %d", s, skb->len);
+
+	if (skb->len != p->len) {
+		p->corrupt++;
+		goto done;
+	}
+
+	seq = get_unaligned_le32(skb->data);
+	for (i = RFCOMM_PROBE_HDR_LEN; i < p->len; i++) {
+		if (skb->data[i] != (u8) (seq + i)) {
+			p->corrupt++;
+			goto done;
+		}
 	}
-	hdr->addr = addr;
-	hdr->ctrl = __ctrl(RFCOMM_UIH, 0);
 
-	crc = skb_put(skb, 1);
-	*crc = __fcs((u8 *) hdr);
+	rtt = ktime_to_ns(now) - (s64) get_unaligned_le64(skb->data + 4);
+	if (rtt < p->rtt_min)
+		p->rtt_min = rtt;
+	if (rtt > p->rtt_max)
+		p->rtt_max = rtt;
+	p->rtt_sum += rtt;
+
+	/* TEST frame is UIH header, MCC type and length, pattern and FCS */
+	p->bytes += p->len + 6;
+
+done:
+	p->received++;
+	p->end = now;
+
+	if (p->received >= p->count)
+		p->state = RFCOMM_PROBE_DONE;
+	else
+		rfcomm_probe_send(s);
 }
 
 /* ---- RFCOMM frame reception ---- */
@@ -1403,16 +1569,23 @@ int RFCOMM_CORE::rfcomm_recv_msc(struct rfcomm_session *s, int cr, struct sk_buf
 
 int RFCOMM_CORE::rfcomm_recv_mcc(struct rfcomm_session *s, struct sk_buff *skb)
 {
-	struct rfcomm_mcc *mcc = (struct rfcomm_mcc *) skb->data;
+	struct rfcomm_mcc_msg m;
 	u8 type, cr, len;
+	int hlen;
 
-	cr   = __test_cr(mcc->type);
-	type = __get_mcc_type(mcc->type);
-	len  = __get_mcc_len(mcc->len);
+	hlen = rfcomm_parse_mcc(skb->data, skb->len, &m);
+	if (hlen < 0) {
+		BT_ERR("truncated control message");
+		return 0;
+	}
+
+	cr   = m.cr;
+	type = m.type;
+	len  = m.len;
 
 	BT_DBG("%p type 0x%x cr %d", s, type, cr);
 
-	skb_pull(skb, 2);
+	skb_pull(skb, hlen);
 
 	switch (type) {
 	case RFCOMM_PN:
@@ -1448,6 +1621,8 @@ int RFCOMM_CORE::rfcomm_recv_mcc(struct rfcomm_session *s, struct sk_buff *skb)
 	case RFCOMM_TEST:
 		if (cr)
 			rfcomm_send_test(s, 0, skb->data, skb->len);
+		else
+			rfcomm_probe_recv(s, skb);
 		break;
 
 	case RFCOMM_NSC:
@@ -1484,6 +1659,8 @@ int RFCOMM_CORE::rfcomm_recv_data(struct rfcomm_session *s, u8 dlci, int pf, str
 	if (skb->len && d->state == BT_CONNECTED) {
 		rfcomm_dlc_lock(d);
 		d->rx_credits--;
+		if (rfcomm_dlc_ext(d)->rx_flush)
+			rfcomm_dlc_ext(d)->rx_flush_pending = true;
 		d->data_ready(d, skb);
 		rfcomm_dlc_unlock(d);
 		return 0;
@@ -1497,8 +1674,8 @@ drop:
 struct rfcomm_session* RFCOMM_CORE::rfcomm_recv_frame(struct rfcomm_session *s,
 						struct sk_buff *skb)
 {
-	struct rfcomm_hdr *hdr = (struct rfcomm_hdr *) skb->data;
-	u8 type, dlci, fcs;
+	struct rfcomm_frame f;
+	int err;
 
 	if (!s) {
 		/* no session, so free socket data */
@@ -1506,54 +1683,50 @@ struct rfcomm_session* RFCOMM_CORE::rfcomm_recv_frame(struct rfcomm_session *s,
 		return s;
 	}
 
-	dlci = __get_dlci(hdr->addr);
-	type = __get_type(hdr->ctrl);
-
-	/* Trim FCS */
-	skb->len--; skb->tail--;
-	fcs = *(u8 *)skb_tail_pointer(skb);
-
-	if (__check_fcs(skb->data, type, fcs)) {
-		BT_ERR("bad checksum in packet");
+	err = rfcomm_parse_frame(skb->data, skb->len, &f);
+	if (err < 0) {
+		if (err == -EILSEQ)
+			BT_ERR("bad checksum in packet");
+		else
+			BT_ERR("truncated packet");
 		kfree_skb(skb);
 		return s;
 	}
 
-	if (__test_ea(hdr->len))
-		skb_pull(skb, 3);
-	else
-		skb_pull(skb, 4);
+	/* Strip header and FCS */
+	skb_pull(skb, f.data - skb->data);
+	skb_trim(skb, f.len);
 
-	switch (type) {
+	switch (f.type) {
 	case RFCOMM_SABM:
-		if (__test_pf(hdr->ctrl))
-			rfcomm_recv_sabm(s, dlci);
+		if (f.pf)
+			rfcomm_recv_sabm(s, f.dlci);
 		break;
 
 	case RFCOMM_DISC:
-		if (__test_pf(hdr->ctrl))
-			s = rfcomm_recv_disc(s, dlci);
+		if (f.pf)
+			s = rfcomm_recv_disc(s, f.dlci);
 		break;
 
 	case RFCOMM_UA:
-		if (__test_pf(hdr->ctrl))
-			s = rfcomm_recv_ua(s, dlci);
+		if (f.pf)
+			s = rfcomm_recv_ua(s, f.dlci);
 		break;
 
 	case RFCOMM_DM:
-		s = rfcomm_recv_dm(s, dlci);
+		s = rfcomm_recv_dm(s, f.dlci);
 		break;
 
 	case RFCOMM_UIH:
-		if (dlci) {
-			rfcomm_recv_data(s, dlci, __test_pf(hdr->ctrl), skb);
+		if (f.dlci) {
+			rfcomm_recv_data(s, f.dlci, f.pf, skb);
 			return s;
 		}
 		rfcomm_recv_mcc(s, skb);
 		break;
 
 	default:
-		BT_ERR("Unknown packet type 0x%02x", type);
+		BT_ERR("Unknown packet type 0x%02x", f.type);
 		break;
 	}
 	kfree_skb(skb);
@@ -1600,11 +1773,16 @@ int RFCOMM_CORE::rfcomm_process_tx(struct rfcomm_dlc *d)
 
 	if (d->cfc) {
 		/* CFC enabled.
-		 * Give them some credits */
+		 * Give them some credits, no more than the owner can take */
+		int max = rfcomm_dlc_ext(d)->rx_credits_max;
+
+		if (max < 0 || max > d->cfc)
+			max = d->cfc;
+
 		if (!test_bit(RFCOMM_RX_THROTTLED, &d->flags) &&
-				d->rx_credits <= (d->cfc >> 2)) {
-			rfcomm_send_credits(d->session, d->addr, d->cfc - d->rx_credits);
-			d->rx_credits = d->cfc;
+				d->rx_credits < max && d->rx_credits <= (max >> 2)) {
+			rfcomm_send_credits(d->session, d->addr, max - d->rx_credits);
+			d->rx_credits = max;
 		}
 	} else {
 		/* CFC disabled.
@@ -1615,16 +1793,29 @@ int RFCOMM_CORE::rfcomm_process_tx(struct rfcomm_dlc *d)
 	if (test_bit(RFCOMM_TX_THROTTLED, &d->flags))
 		return skb_queue_len(&d->tx_queue);
 
+	/* Data waits for the control lane */
+	if (!skb_queue_empty(rfcomm_session_ctrl_queue(d->session)))
+		return skb_queue_len(&d->tx_queue);
+
 	while (d->tx_credits && (skb = skb_dequeue(&d->tx_queue))) {
-		err = rfcomm_send_frame(d->session, skb->data, skb->len);
+		err = rfcomm_send_skb(d->session, skb);
 		if (err < 0) {
 			skb_queue_head(&d->tx_queue, skb);
 			break;
 		}
-		kfree_skb(skb);
+		skb_tx_timestamp(skb);
+
+		if (rfcomm_dlc_ext(d)->tx_done)
+			rfcomm_dlc_ext(d)->tx_done(d, skb);
+		else
+			kfree_skb(skb);
 		d->tx_credits--;
 	}
 
+	if (skb_queue_empty(&d->tx_queue) &&
+			test_and_clear_bit(RFCOMM_DISC_PENDING, &d->flags))
+		rfcomm_send_disc(d->session, d->dlci);
+
 	if (d->cfc && !d->tx_credits) {
 		/* We're out of TX credits.
 		 * Set TX_THROTTLED flag to avoid unnesary wakeups by dlc_send. */
@@ -1641,6 +1832,9 @@ void RFCOMM_CORE::rfcomm_process_dlcs(struct rfcomm_session *s)
 
 	BT_DBG("session %p state %ld", s, s->state);
 
+	/* Retry what the socket didn't take last time */
+	rfcomm_process_ctrl(s);
+
 	list_for_each_safe(p, n, &s->dlcs) {
 		d = list_entry(p, struct rfcomm_dlc, list);
 
@@ -1705,48 +1899,87 @@ struct rfcomm_session* RFCOMM_CORE::rfcomm_process_rx(struct rfcomm_session *s)
 	/* Get data directly from socket receive queue without copying it. */
 	while ((skb = skb_dequeue(&sk->sk_receive_queue))) {
 		skb_orphan(skb);
+
+		/* RX timestamp reported by SO_TIMESTAMP(ING) */
+		__net_timestamp(skb);
+
 		if (!skb_linearize(skb))
 			s = rfcomm_recv_frame(s, skb);
 		else
 			kfree_skb(skb);
 	}
 
+	if (s)
+		rfcomm_process_rx_flush(s);
+
 	if (s && (sk->sk_state == BT_CLOSED))
 		s = rfcomm_session_close(s, sk->sk_err);
 
 	return s;
 }
 
+/* Let owners batch per pass what they would otherwise do per frame */
+void RFCOMM_CORE::rfcomm_process_rx_flush(struct rfcomm_session *s)
+{
+	struct rfcomm_dlc *d;
+
+	list_for_each_entry(d, &s->dlcs, list) {
+		struct rfcomm_dlc_ext *ext = rfcomm_dlc_ext(d);
+
+		if (!ext->rx_flush_pending)
+			continue;
+
+		rfcomm_dlc_lock(d);
+		ext->rx_flush_pending = false;
+		rfcomm_dlc_unlock(d);
+
+		/* Without the DLC lock, the owner may push into the ldisc.
+		 * The session's reference keeps d around under rfcomm_lock. */
+		ext->rx_flush(d);
+	}
+}
+
 void RFCOMM_CORE::rfcomm_accept_connection(struct rfcomm_session *s)
 {
 	struct socket *sock = s->sock, *nsock;
-	int err;
+	struct rfcomm_session *ns;
+	int err, accepted = 0;
+	bool any = !bacmp(&bt_sk(sock->sk)->src, BDADDR_ANY);
 
 	/* Fast check for a new connection.
 	 * Avoids unnesesary socket allocations. */
-	if (list_empty(&bt_sk(sock->sk)->accept_q))
-		return;
+	while (!list_empty(&bt_sk(sock->sk)->accept_q)) {
+		BT_DBG("session %p", s);
 
-	BT_DBG("session %p", s);
+		err = kernel_accept(sock, &nsock, O_NONBLOCK);
+		if (err < 0)
+			break;
 
-	err = kernel_accept(sock, &nsock, O_NONBLOCK);
-	if (err < 0)
-		return;
+		/* Set our callbacks */
+		nsock->sk->sk_data_ready   = rfcomm_l2data_ready;
+		nsock->sk->sk_state_change = rfcomm_l2state_change;
 
-	/* Set our callbacks */
-	nsock->sk->sk_data_ready   = rfcomm_l2data_ready;
-	nsock->sk->sk_state_change = rfcomm_l2state_change;
+		ns = rfcomm_session_add(nsock, BT_OPEN);
+		if (!ns) {
+			sock_release(nsock);
+			continue;
+		}
 
-	s = rfcomm_session_add(nsock, BT_OPEN);
-	if (s) {
 		/* We should adjust MTU on incoming sessions.
 		 * L2CAP MTU minus UIH header and FCS. */
-		s->mtu = min(l2cap_pi(nsock->sk)->chan->omtu,
+		ns->mtu = min(l2cap_pi(nsock->sk)->chan->omtu,
 				l2cap_pi(nsock->sk)->chan->imtu) - 5;
 
+		/* First connection through the wildcard listener on this
+		 * adapter, give the adapter a listener of its own. */
+		if (any && adapter_listeners)
+			rfcomm_add_adapter_listener(&bt_sk(nsock->sk)->src);
+
+		accepted++;
+	}
+
+	if (accepted)
 		rfcomm_schedule();
-	} else
-		sock_release(nsock);
 }
 
 struct rfcomm_session* RFCOMM_CORE::rfcomm_check_connection(struct rfcomm_session *s)
@@ -1779,6 +2012,11 @@ void RFCOMM_CORE::rfcomm_process_sessions(void)
 
 	rfcomm_lock();
 
+	rfcomm_wheel_run();
+
+	/* Set again by sessions that still can't send */
+	rfcomm_ctrl_retry = false;
+
 	list_for_each_safe(p, n, &session_list) {
 		struct rfcomm_session *s;
 		s = list_entry(p, struct rfcomm_session, list);
@@ -1804,11 +2042,34 @@ void RFCOMM_CORE::rfcomm_process_sessions(void)
 			break;
 		}
 
+		if (s) {
+			rfcomm_probe_send(s);
+			rfcomm_process_dlcs(s);
+		}
+	}
+
+	rfcomm_unlock();
+}
+
+/* Do what krfcommd would do for the DLC's session, but inline.
+ * Returns -EAGAIN if krfcommd is busy, the caller may retry. */
+int RFCOMM_CORE::rfcomm_dlc_busy_poll(struct rfcomm_dlc *d)
+{
+	struct rfcomm_session *s;
+
+	if (!mutex_trylock(&rfcomm_mutex))
+		return -EAGAIN;
+
+	s = d->session;
+	if (s && s->state == BT_CONNECTED &&
+			!skb_queue_empty(&s->sock->sk->sk_receive_queue)) {
+		s = rfcomm_process_rx(s);
 		if (s)
 			rfcomm_process_dlcs(s);
 	}
 
 	rfcomm_unlock();
+	return 0;
 }
 
 int RFCOMM_CORE::rfcomm_add_listener(bdaddr_t *ba)
@@ -1844,7 +2105,7 @@ int RFCOMM_CORE::rfcomm_add_listener(bdaddr_t *ba)
 	release_sock(sk);
 
 	/* Start listening on the socket */
-	err = kernel_listen(sock, 10);
+	err = kernel_listen(sock, listen_backlog);
 	if (err) {
 		BT_ERR("Listen failed %d", err);
 		goto failed;
@@ -1863,8 +2124,59 @@ failed:
 	return err;
 }
 
+struct rfcomm_session* RFCOMM_CORE::rfcomm_get_listener(bdaddr_t *ba)
+{
+	struct rfcomm_session *s;
+
+	list_for_each_entry(s, &session_list, list) {
+		if (s->state == BT_LISTEN &&
+				!bacmp(&bt_sk(s->sock->sk)->src, ba))
+			return s;
+	}
+
+	return NULL;
+}
+
+void RFCOMM_CORE::rfcomm_add_adapter_listener(bdaddr_t *ba)
+{
+	struct rfcomm_listener_fail *f, *fail = NULL;
+
+	if (rfcomm_get_listener(ba))
+		return;
+
+	list_for_each_entry(f, &listener_fail_list, list) {
+		if (!bacmp(&f->ba, ba)) {
+			fail = f;
+			break;
+		}
+	}
+
+	if (fail && time_before(jiffies, fail->retry))
+		return;
+
+	if (!rfcomm_add_listener(ba)) {
+		if (fail) {
+			list_del(&fail->list);
+			kfree(fail);
+		}
+		return;
+	}
+
+	if (!fail) {
+		fail = (struct rfcomm_listener_fail *) kzalloc(sizeof(*fail), GFP_KERNEL);
+		if (!fail)
+			return;
+
+		bacpy(&fail->ba, ba);
+		list_add(&fail->list, &listener_fail_list);
+	}
+
+	fail->retry = jiffies + RFCOMM_LISTENER_RETRY;
+}
+
 void RFCOMM_CORE::rfcomm_kill_listener(void)
 {
+	struct rfcomm_listener_fail *f, *tmp;
 	struct rfcomm_session *s;
 	struct list_head *p, *n;
 
@@ -1874,10 +2186,17 @@ void RFCOMM_CORE::rfcomm_kill_listener(void)
 		s = list_entry(p, struct rfcomm_session, list);
 		rfcomm_session_del(s);
 	}
+
+	list_for_each_entry_safe(f, tmp, &listener_fail_list, list) {
+		list_del(&f->list);
+		kfree(f);
+	}
 }
 
 int RFCOMM_CORE::rfcomm_run_cls(void *unused)
 {
+	long timeo;
+
 	BT_DBG("");
 
 	set_user_nice(current, -10);
@@ -1893,7 +2212,11 @@ int RFCOMM_CORE::rfcomm_run_cls(void *unused)
 		/* Process stuff */
 		rfcomm_process_sessions();
 
-		schedule();
+		timeo = rfcomm_wheel_timeout();
+		if (rfcomm_ctrl_retry)
+			timeo = min_t(long, timeo, RFCOMM_CTRL_RETRY);
+
+		schedule_timeout(timeo);
 	}
 	__set_current_state(TASK_RUNNING);
 
@@ -1976,6 +2299,115 @@ int RFCOMM_CORE::rfcomm_dlc_debugfs_open_cls(struct inode *inode, struct file *f
         return single_open(file, rfcomm_dlc_debugfs_show, inode->i_private);
 }
 
+int RFCOMM_CORE::rfcomm_probe_debugfs_show_cls(struct seq_file *f, void *x)
+{
+	struct rfcomm_session *s;
+
+	rfcomm_lock();
+
+	list_for_each_entry(s, &session_list, list) {
+		struct rfcomm_probe *p = rfcomm_session_probe(s);
+		struct sock *sk = s->sock->sk;
+		u32 good = p->received - p->corrupt;
+		s64 elapsed = ktime_to_ns(ktime_sub(p->end, p->start));
+		u64 rate = 0;
+
+		if (s->state == BT_LISTEN || p->state == RFCOMM_PROBE_IDLE)
+			continue;
+
+		if (elapsed > 0)
+			rate = div64_u64(p->bytes * NSEC_PER_SEC, elapsed);
+
+		seq_printf(f, "%pMR %pMR %d %u %u %u %u %lld %lld %lld %llu\n",
+			   &bt_sk(sk)->src, &bt_sk(sk)->dst, p->state,
+			   p->len, p->sent, p->received, p->corrupt,
+			   good ? div_s64(p->rtt_min, NSEC_PER_USEC) : 0,
+			   good ? div_s64(div_s64(p->rtt_sum, good), NSEC_PER_USEC) : 0,
+			   good ? div_s64(p->rtt_max, NSEC_PER_USEC) : 0,
+			   rate);
+	}
+
+	rfcomm_unlock();
+
+	return 0;
+}
+
+int RFCOMM_CORE::rfcomm_probe_debugfs_open_cls(struct inode *inode, struct file *file)
+{
+	return single_open(file, rfcomm_probe_debugfs_show, inode->i_private);
+}
+
+int RFCOMM_CORE::rfcomm_ctrl_debugfs_show_cls(struct seq_file *f, void *x)
+{
+	struct rfcomm_session *s;
+
+	rfcomm_lock();
+
+	list_for_each_entry(s, &session_list, list) {
+		struct rfcomm_ctrl *c = rfcomm_session_ctrl(s);
+		struct sock *sk = s->sock->sk;
+
+		if (s->state == BT_LISTEN)
+			continue;
+
+		seq_printf(f, "%pMR %pMR %u %u %u %u %llu\n",
+			   &bt_sk(sk)->src, &bt_sk(sk)->dst,
+			   skb_queue_len(rfcomm_session_ctrl_queue(s)),
+			   c->sent, c->retries, c->dropped, c->bytes);
+	}
+
+	rfcomm_unlock();
+
+	return 0;
+}
+
+int RFCOMM_CORE::rfcomm_ctrl_debugfs_open_cls(struct inode *inode, struct file *file)
+{
+	return single_open(file, rfcomm_ctrl_debugfs_show, inode->i_private);
+}
+
+/* Start a probe: "<bdaddr> <count> <len>" */
+ssize_t RFCOMM_CORE::rfcomm_probe_debugfs_write_cls(struct file *file,
+				const char __user *user_buf, size_t count, loff_t *ppos)
+{
+	struct rfcomm_session *s;
+	unsigned int n, len;
+	bdaddr_t dst;
+	char buf[48];
+	size_t size = min(count, sizeof(buf) - 1);
+	int err = 0;
+
+	if (copy_from_user(buf, user_buf, size))
+		return -EFAULT;
+
+	buf[size] = '\0';
+
+	if (sscanf(buf, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx %u %u",
+			&dst.b[5], &dst.b[4], &dst.b[3],
+			&dst.b[2], &dst.b[1], &dst.b[0], &n, &len) != 8)
+		return -EINVAL;
+
+	if (!n || len < RFCOMM_PROBE_HDR_LEN || len > RFCOMM_PROBE_MAX_LEN)
+		return -EINVAL;
+
+	rfcomm_lock();
+
+	s = rfcomm_session_get(BDADDR_ANY, &dst);
+	if (s && s->state == BT_CONNECTED)
+		rfcomm_probe_start(s, n, len);
+	else
+		err = -ENOTCONN;
+
+	rfcomm_unlock();
+
+	if (err < 0)
+		return err;
+
+	rfcomm_schedule();
+
+	return count;
+}
+
 void rfcomm_dlc_free(struct rfcomm_dlc *d){
 	rfcomm_core.rfcomm_dlc_free(d);
 }
@@ -2000,6 +2432,14 @@ void __rfcomm_dlc_unthrottle(struct rfcomm_dlc *d){
 	rfcomm_core.__rfcomm_dlc_unthrottle(d);
 }
 
+void rfcomm_dlc_set_rx_space(struct rfcomm_dlc *d, int space){
+	rfcomm_core.rfcomm_dlc_set_rx_space(d, space);
+}
+
+int rfcomm_dlc_busy_poll(struct rfcomm_dlc *d){
+	return rfcomm_core.rfcomm_dlc_busy_poll(d);
+}
+
 int rfcomm_dlc_set_modem_status(struct rfcomm_dlc *d, u8 v24_sig){
 	return rfcomm_core.rfcomm_dlc_set_modem_status(d, v24_sig);
 }
@@ -2034,6 +2474,16 @@ static void rfcomm_security_cfm(struct hci_conn *conn, u8 status, u8 encrypt){
 static int rfcomm_dlc_debugfs_open(struct inode *inode, struct file *file){
 	return rfcomm_core.rfcomm_dlc_debugfs_open_cls(inode, file);
 }
+static int rfcomm_probe_debugfs_open(struct inode *inode, struct file *file){
+	return rfcomm_core.rfcomm_probe_debugfs_open_cls(inode, file);
+}
+static int rfcomm_ctrl_debugfs_open(struct inode *inode, struct file *file){
+	return rfcomm_core.rfcomm_ctrl_debugfs_open_cls(inode, file);
+}
+static ssize_t rfcomm_probe_debugfs_write(struct file *file,
+				const char __user *user_buf, size_t count, loff_t *ppos){
+	return rfcomm_core.rfcomm_probe_debugfs_write_cls(file, user_buf, count, ppos);
+}
 
 
 // EXPOSED
@@ -2047,11 +2497,11 @@ void rfcomm_l2data_ready(struct sock *sk, int bytes){
 
 
 
-void rfcomm_dlc_timeout(unsigned long arg){
-	rfcomm_core.rfcomm_dlc_timeout_cls(arg);
+void rfcomm_dlc_ctor(void *obj){
+	rfcomm_core.rfcomm_dlc_ctor_cls(obj);
 }
-void rfcomm_session_timeout(unsigned long arg){
-	rfcomm_core.rfcomm_session_timeout_cls(arg);
+void rfcomm_session_ctor(void *obj){
+	rfcomm_core.rfcomm_session_ctor_cls(obj);
 }
 int rfcomm_run(void *unused){
 	return rfcomm_core.rfcomm_run_cls(unused);
@@ -2064,13 +2514,43 @@ struct rfcomm_dlc *rfcomm_dlc_alloc(gfp_t prio){
 int rfcomm_dlc_debugfs_show(struct seq_file *f, void *x){
 	return rfcomm_core.rfcomm_dlc_debugfs_show_cls(f, x);
 }
+
+int rfcomm_probe_debugfs_show(struct seq_file *f, void *x){
+	return rfcomm_core.rfcomm_probe_debugfs_show_cls(f, x);
+}
+
+int rfcomm_ctrl_debugfs_show(struct seq_file *f, void *x){
+	return rfcomm_core.rfcomm_ctrl_debugfs_show_cls(f, x);
+}
 extern "C" {
 static struct dentry *rfcomm_dlc_debugfs;
+static struct dentry *rfcomm_probe_debugfs;
+static struct dentry *rfcomm_ctrl_debugfs;
 
 /* ---- Initialization ---- */
 static int __init rfcomm_init(void)
 {
-	int err;
+	int err, i;
+
+	spin_lock_init(&rfcomm_wheel.lock);
+	for (i = 0; i < RFCOMM_WHEEL_SLOTS; i++)
+		INIT_LIST_HEAD(&rfcomm_wheel.slot[i]);
+
+	/* Named caches with constructors are never merged, their object
+	 * counts show up in /proc/slabinfo. */
+	rfcomm_dlc_cache = kmem_cache_create("rfcomm_dlc",
+				sizeof(struct rfcomm_dlc_ext), 0,
+				SLAB_HWCACHE_ALIGN, rfcomm_dlc_ctor);
+	if (!rfcomm_dlc_cache)
+		return -ENOMEM;
+
+	rfcomm_session_cache = kmem_cache_create("rfcomm_session",
+				sizeof(struct rfcomm_session_ext), 0,
+				SLAB_HWCACHE_ALIGN, rfcomm_session_ctor);
+	if (!rfcomm_session_cache) {
+		err = -ENOMEM;
+		goto free_dlc_cache;
+	}
 
 	hci_register_cb(&rfcomm_cb);
 
@@ -2085,6 +2565,16 @@ static int __init rfcomm_init(void)
 				bt_debugfs, NULL, &rfcomm_dlc_debugfs_fops);
 		if (!rfcomm_dlc_debugfs)
 			BT_ERR("Failed to create RFCOMM debug file");
+
+		rfcomm_probe_debugfs = debugfs_create_file("rfcomm_probe", 0644,
+				bt_debugfs, NULL, &rfcomm_probe_debugfs_fops);
+		if (!rfcomm_probe_debugfs)
+			BT_ERR("Failed to create RFCOMM probe debug file");
+
+		rfcomm_ctrl_debugfs = debugfs_create_file("rfcomm_ctrl", 0444,
+				bt_debugfs, NULL, &rfcomm_ctrl_debugfs_fops);
+		if (!rfcomm_ctrl_debugfs)
+			BT_ERR("Failed to create RFCOMM control debug file");
 	}
 
 	err = rfcomm_init_ttys();
@@ -2108,11 +2598,18 @@ stop:
 unregister:
 	hci_unregister_cb(&rfcomm_cb);
 
+	kmem_cache_destroy(rfcomm_session_cache);
+
+free_dlc_cache:
+	kmem_cache_destroy(rfcomm_dlc_cache);
+
 	return err;
 }
 
 static void __exit rfcomm_exit(void)
 {
+	debugfs_remove(rfcomm_ctrl_debugfs);
+	debugfs_remove(rfcomm_probe_debugfs);
 	debugfs_remove(rfcomm_dlc_debugfs);
 
 	hci_unregister_cb(&rfcomm_cb);
@@ -2122,6 +2619,9 @@ static void __exit rfcomm_exit(void)
 	rfcomm_cleanup_ttys();
 
 	rfcomm_cleanup_sockets();
+
+	kmem_cache_destroy(rfcomm_session_cache);
+	kmem_cache_destroy(rfcomm_dlc_cache);
 }
 
 module_init(rfcomm_init);
@@ -2140,6 +2640,14 @@ MODULE_PARM_DESC(l2cap_mtu, "Default MTU for the L2CAP connection");
 module_param(l2cap_ertm, bool, 0644);
 MODULE_PARM_DESC(l2cap_ertm, "Use L2CAP ERTM mode for connection");
 
+module_param(listen_backlog, uint, 0644);
+MODULE_PARM_DESC(listen_backlog, "Backlog of the L2CAP listening sockets");
+
+module_param(adapter_listeners, bool, 0644);
+MODULE_PARM_DESC(adapter_listeners, "Use a listening session per adapter");
+
+L2SHAPE_MODULE_PARAMS(shape_params);
+
 
 
 MODULE_AUTHOR("Marcel Holtmann <marcel@holtmann.org>");
@@ -36,12 +36,17 @@
 #include <net/bluetooth/l2cap.h>
 #include <net/bluetooth/rfcomm.h>
 
-#include "fcs_computation.h"
+#include "codec.h"
+#include "rfcomm_ext.h"
+#include "../l2shape.h"
 
 #include <c++/end_include.h>
 
 #define VERSION "1.11"
 
+/* DLC flag: DISC goes out on the control lane once tx_queue is empty */
+#define RFCOMM_DISC_PENDING	16
+
 #define rfcomm_lock()	mutex_lock(&rfcomm_mutex)
 #define rfcomm_unlock()	mutex_unlock(&rfcomm_mutex)
 
@@ -49,12 +54,144 @@ static bool disable_cfc;
 static bool l2cap_ertm;
 static int channel_mtu = -1;
 static unsigned int l2cap_mtu = RFCOMM_MAX_L2CAP_MTU;
+static unsigned int listen_backlog = 10;
+static bool adapter_listeners = 1;
+static struct l2shape_params shape_params = { 0, 0, 0, 0, 0, 0, 0, L2SHAPE_LIMIT };
 
 static struct task_struct *rfcomm_thread;
 
+static struct kmem_cache *rfcomm_dlc_cache;
+static struct kmem_cache *rfcomm_session_cache;
+
 static DEFINE_MUTEX(rfcomm_mutex);
 static LIST_HEAD(session_list);
 
+/* Adapters whose own listener could not be set up. They are tried
+ * again after RFCOMM_LISTENER_RETRY, not on every connection. */
+#define RFCOMM_LISTENER_RETRY	(60 * HZ)
+
+struct rfcomm_listener_fail {
+	struct list_head	list;
+	bdaddr_t		ba;
+	unsigned long		retry;
+};
+
+static LIST_HEAD(listener_fail_list);
+
+/* ---- RFCOMM timeout wheel ----
+ *
+ * DLC and session timeouts only flag the object for krfcommd, so they
+ * don't get a timer each. Entries are hashed by expiry into coarse
+ * slots, krfcommd expires the slots that came due at the start of every
+ * pass and sleeps until the next non-empty one.
+ */
+#define RFCOMM_WHEEL_TICK	(HZ / 2)
+#define RFCOMM_WHEEL_SLOTS	64
+
+#define rfcomm_wheel_tick(j)	(((j) - INITIAL_JIFFIES) / RFCOMM_WHEEL_TICK)
+
+struct rfcomm_wheel {
+	spinlock_t		lock;
+	unsigned long		clock;
+	unsigned int		count;
+	struct list_head	slot[RFCOMM_WHEEL_SLOTS];
+};
+
+static struct rfcomm_wheel rfcomm_wheel;
+
+/* ---- RFCOMM link probe ----
+ *
+ * Probe TEST frames start with a sequence number and the local send time,
+ * the rest of the pattern is derived from the sequence number so that a
+ * corrupted echo can be told apart from a good one.
+ */
+#define RFCOMM_PROBE_HDR_LEN	12
+#define RFCOMM_PROBE_MAX_LEN	125
+#define RFCOMM_PROBE_WINDOW	8
+
+#define RFCOMM_PROBE_IDLE	0
+#define RFCOMM_PROBE_RUNNING	1
+#define RFCOMM_PROBE_DONE	2
+
+struct rfcomm_probe {
+	int		state;
+	u32		count;
+	u8		len;
+
+	u32		sent;
+	u32		received;
+	u32		corrupt;
+	u64		bytes;
+
+	s64		rtt_min;
+	s64		rtt_max;
+	s64		rtt_sum;
+
+	ktime_t		start;
+	ktime_t		end;
+};
+
+/* ---- RFCOMM control lane ----
+ *
+ * Everything but UIH data goes through the session's control queue,
+ * which is drained before any DLC gets to send data. A frame the socket
+ * doesn't take stays at the head, krfcommd retries it after
+ * RFCOMM_CTRL_RETRY and drops it after RFCOMM_CTRL_RETRIES attempts.
+ */
+#define RFCOMM_CTRL_RETRY	(HZ / 10)
+#define RFCOMM_CTRL_RETRIES	8
+
+/* Some session has a control frame waiting for a retry */
+static bool rfcomm_ctrl_retry;
+
+struct rfcomm_ctrl {
+	unsigned long	busy;
+	u8		attempts;
+	u32		sent;
+	u32		retries;
+	u32		dropped;
+	u64		bytes;
+};
+
+struct rfcomm_session_ext {
+	struct rfcomm_session	s;
+
+	/* Set up by the slab constructor */
+	struct rfcomm_tmo	tmo;
+	struct sk_buff_head	ctrl_queue;
+
+	/* Cleared on allocation */
+	struct rfcomm_ctrl	ctrl;
+	struct rfcomm_probe	probe;
+	struct l2shape		shape;
+};
+
+static inline struct rfcomm_probe *rfcomm_session_probe(struct rfcomm_session *s)
+{
+	return &container_of(s, struct rfcomm_session_ext, s)->probe;
+}
+
+static inline struct rfcomm_tmo *rfcomm_session_tmo(struct rfcomm_session *s)
+{
+	return &container_of(s, struct rfcomm_session_ext, s)->tmo;
+}
+
+static inline struct rfcomm_ctrl *rfcomm_session_ctrl(struct rfcomm_session *s)
+{
+	return &container_of(s, struct rfcomm_session_ext, s)->ctrl;
+}
+
+static inline struct sk_buff_head *rfcomm_session_ctrl_queue(struct rfcomm_session *s)
+{
+	return &container_of(s, struct rfcomm_session_ext, s)->ctrl_queue;
+}
+
+/* Everything sent on the session's L2CAP socket goes through this */
+static inline struct l2shape *rfcomm_session_shape(struct rfcomm_session *s)
+{
+	return &container_of(s, struct rfcomm_session_ext, s)->shape;
+}
+
 static void rfcomm_schedule(void)
 {
 	if (!rfcomm_thread)
@@ -72,6 +209,17 @@ private:
 
 	int rfcomm_check_security(struct rfcomm_dlc *d);
 
+	/* ---- RFCOMM timeout wheel ---- */
+	void rfcomm_tmo_set(struct rfcomm_tmo *t, long timeout);
+
+	void rfcomm_tmo_clear(struct rfcomm_tmo *t);
+
+	/* Flag everything that expired since the last run */
+	void rfcomm_wheel_run(void);
+
+	/* How long krfcommd may sleep before the wheel needs a run */
+	long rfcomm_wheel_timeout(void);
+
 	void rfcomm_session_set_timer(struct rfcomm_session *s, long timeout);
 
 	void rfcomm_session_clear_timer(struct rfcomm_session *s);
@@ -111,8 +259,18 @@ private:
 								int *err);
 
 	/* ---- RFCOMM frame sending ---- */
+	int rfcomm_xmit_frame(struct rfcomm_session *s, u8 *data, int len);
+
+	/* Queue a control frame and push the control lane */
 	int rfcomm_send_frame(struct rfcomm_session *s, u8 *data, int len);
 
+	/* Send queued control frames.
+	 * Return number of frames left in the queue.
+	 */
+	int rfcomm_process_ctrl(struct rfcomm_session *s);
+
+	int rfcomm_send_skb(struct rfcomm_session *s, struct sk_buff *skb);
+
 	int rfcomm_send_cmd(struct rfcomm_session *s, struct rfcomm_cmd *cmd);
 
 	int rfcomm_send_sabm(struct rfcomm_session *s, u8 dlci);
@@ -121,8 +279,6 @@ private:
 
 	int rfcomm_send_disc(struct rfcomm_session *s, u8 dlci);
 
-	int rfcomm_queue_disc(struct rfcomm_dlc *d);
-
 	int rfcomm_send_dm(struct rfcomm_session *s, u8 dlci);
 
 	int rfcomm_send_nsc(struct rfcomm_session *s, int cr, u8 type);
@@ -143,6 +299,14 @@ private:
 
 	void rfcomm_make_uih(struct sk_buff *skb, u8 addr);
 
+	/* ---- RFCOMM link probe ---- */
+	void rfcomm_probe_start(struct rfcomm_session *s, u32 count, u8 len);
+
+	/* Keep up to RFCOMM_PROBE_WINDOW TEST commands outstanding */
+	void rfcomm_probe_send(struct rfcomm_session *s);
+
+	void rfcomm_probe_recv(struct rfcomm_session *s, struct sk_buff *skb);
+
 	/* ---- RFCOMM frame reception ---- */
 	struct rfcomm_session *rfcomm_recv_ua(struct rfcomm_session *s, u8 dlci);
 
@@ -184,6 +348,9 @@ private:
 
 	struct rfcomm_session *rfcomm_process_rx(struct rfcomm_session *s);
 
+	void rfcomm_process_rx_flush(struct rfcomm_session *s);
+
+	/* Accept all pending connections of a listening session */
 	void rfcomm_accept_connection(struct rfcomm_session *s);
 
 	struct rfcomm_session *rfcomm_check_connection(struct rfcomm_session *s);
@@ -192,11 +359,16 @@ private:
 
 	int rfcomm_add_listener(bdaddr_t *ba);
 
+	struct rfcomm_session *rfcomm_get_listener(bdaddr_t *ba);
+
+	void rfcomm_add_adapter_listener(bdaddr_t *ba);
+
 	void rfcomm_kill_listener(void);
 
 //	int rfcomm_run(void *unused);
 
 //	int rfcomm_dlc_debugfs_show(struct seq_file *f, void *x);
+//	int rfcomm_probe_debugfs_show(struct seq_file *f, void *x);
 
 public:
 /* public methods */
@@ -212,6 +384,10 @@ public:
 
 	void __rfcomm_dlc_unthrottle(struct rfcomm_dlc *d);
 
+	void rfcomm_dlc_set_rx_space(struct rfcomm_dlc *d, int space);
+
+	int rfcomm_dlc_busy_poll(struct rfcomm_dlc *d);
+
 	int rfcomm_dlc_set_modem_status(struct rfcomm_dlc *d, u8 v24_sig);
 
 	int rfcomm_dlc_get_modem_status(struct rfcomm_dlc *d, u8 *v24_sig);
@@ -230,15 +406,23 @@ public:
 	void rfcomm_security_cfm_cls(struct hci_conn *conn, u8 status, u8 encrypt);
 	// file operations
 	int rfcomm_dlc_debugfs_open_cls(struct inode *inode, struct file *file);
+	int rfcomm_probe_debugfs_open_cls(struct inode *inode, struct file *file);
+	int rfcomm_ctrl_debugfs_open_cls(struct inode *inode, struct file *file);
+	ssize_t rfcomm_probe_debugfs_write_cls(struct file *file,
+				const char __user *user_buf, size_t count, loff_t *ppos);
 
 	 // method access related
 	void rfcomm_l2state_change_cls(struct sock *sk);
 	void rfcomm_l2data_ready_cls(struct sock *sk, int bytes);
-	void rfcomm_dlc_timeout_cls(unsigned long arg);
-	void rfcomm_session_timeout_cls(unsigned long arg);
+	/* Slab constructors. The timeout entry, TX queue and lock are set up
+	 * once per object and must be back in that state when it is freed. */
+	void rfcomm_dlc_ctor_cls(void *obj);
+	void rfcomm_session_ctor_cls(void *obj);
 	int rfcomm_run_cls(void *unused);
         struct rfcomm_dlc *rfcomm_dlc_alloc_cls(gfp_t prio);
 	int rfcomm_dlc_debugfs_show_cls(struct seq_file *f, void *x);
+	int rfcomm_probe_debugfs_show_cls(struct seq_file *f, void *x);
+	int rfcomm_ctrl_debugfs_show_cls(struct seq_file *f, void *x);
 }rfcomm_core;
 
 
@@ -254,6 +438,10 @@ void __rfcomm_dlc_throttle(struct rfcomm_dlc *d);
 
 void __rfcomm_dlc_unthrottle(struct rfcomm_dlc *d);
 
+void rfcomm_dlc_set_rx_space(struct rfcomm_dlc *d, int space);
+
+int rfcomm_dlc_busy_poll(struct rfcomm_dlc *d);
+
 int rfcomm_dlc_set_modem_status(struct rfcomm_dlc *d, u8 v24_sig);
 
 int rfcomm_dlc_get_modem_status(struct rfcomm_dlc *d, u8 *v24_sig);
@@ -272,17 +460,23 @@ int rfcomm_send_rpn(struct rfcomm_session *s, int cr, u8 dlci,
 static void rfcomm_security_cfm(struct hci_conn *conn, u8 status, u8 encrypt);
 // file operations
 static int rfcomm_dlc_debugfs_open(struct inode *inode, struct file *file);
+static int rfcomm_probe_debugfs_open(struct inode *inode, struct file *file);
+static int rfcomm_ctrl_debugfs_open(struct inode *inode, struct file *file);
+static ssize_t rfcomm_probe_debugfs_write(struct file *file,
+				const char __user *user_buf, size_t count, loff_t *ppos);
 
 
 
 // exposed
 void rfcomm_l2state_change(struct sock *sk);
 void rfcomm_l2data_ready(struct sock *sk, int bytes);
-void rfcomm_dlc_timeout(unsigned long arg);
-void rfcomm_session_timeout(unsigned long arg);
+void rfcomm_dlc_ctor(void *obj);
+void rfcomm_session_ctor(void *obj);
 int rfcomm_run(void *unused);
 struct rfcomm_dlc *rfcomm_dlc_alloc(gfp_t prio);
 int rfcomm_dlc_debugfs_show(struct seq_file *f, void *x);
+int rfcomm_probe_debugfs_show(struct seq_file *f, void *x);
+int rfcomm_ctrl_debugfs_show(struct seq_file *f, void *x);
 
 static struct hci_cb rfcomm_cb = {
 	.name		= "RFCOMM",
@@ -295,3 +489,18 @@ static const struct file_operations rfcomm_dlc_debugfs_fops = {
 	.llseek		= seq_lseek,
 	.release	= single_release,
 };
+
+static const struct file_operations rfcomm_probe_debugfs_fops = {
+	.open		= rfcomm_probe_debugfs_open,
+	.read		= seq_read,
+	.write		= rfcomm_probe_debugfs_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static const struct file_operations rfcomm_ctrl_debugfs_fops = {
+	.open		= rfcomm_ctrl_debugfs_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
@@ -1,15 +1,8 @@
-#include <c++/begin_include.h>
-#include <linux/module.h>
-#include <linux/debugfs.h>
-#include <linux/kthread.h>
-#include <asm/unaligned.h>
+#ifndef __RFCOMM_FCS_COMPUTATION_H
+#define __RFCOMM_FCS_COMPUTATION_H
 
-#include <net/bluetooth/bluetooth.h>
-#include <net/bluetooth/hci_core.h>
-#include <net/bluetooth/l2cap.h>
-#include <net/bluetooth/rfcomm.h>
-
-#include <c++/end_include.h>
+/* Needs nothing but u8 and RFCOMM_UIH from the includer, which lets
+ * tools/rfcomm build it in userspace. */
 
 /* ---- RFCOMM frame parsing macros ---- */
 #define __get_dlci(b)     ((b & 0xfc) >> 2)
@@ -127,3 +120,5 @@ static inline u8 __fcs2(u8 *data){
 static inline int __check_fcs(u8 *data, int type, u8 fcs){
 	return fcs_compute.__check_fcs(data, type, fcs);
 }
+
+#endif /* __RFCOMM_FCS_COMPUTATION_H */
@@ -0,0 +1,80 @@
+/*
+   RFCOMM implementation for Linux Bluetooth stack (BlueZ).
+   Copyright (C) 2002 Maxim Krasnyansky <maxk@qualcomm.com>
+   Copyright (C) 2002 Marcel Holtmann <marcel@holtmann.org>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation;
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT OF THIRD PARTY RIGHTS.
+   IN NO EVENT SHALL THE COPYRIGHT HOLDER(S) AND AUTHOR(S) BE LIABLE FOR ANY
+   CLAIM, OR ANY SPECIAL INDIRECT OR CONSEQUENTIAL DAMAGES, OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+   ALL LIABILITY, INCLUDING LIABILITY FOR INFRINGEMENT OF ANY PATENTS,
+   COPYRIGHTS, TRADEMARKS OR OTHER RIGHTS, RELATING TO USE OF THIS
+   SOFTWARE IS DISCLAIMED.
+*/
+
+/*
+ * RFCOMM core extensions shared by the core, socket and TTY layers.
+ */
+
+#ifndef __RFCOMM_EXT_H
+#define __RFCOMM_EXT_H
+
+/* Timeout wheel entry, owned by the core. Expiry sets
+ * RFCOMM_TIMED_OUT in *flags and leaves the rest to krfcommd. */
+struct rfcomm_tmo {
+	struct list_head	list;
+	unsigned long		expires;
+	unsigned long		*flags;
+};
+
+/* Private DLC data, rfcomm_dlc must stay first. The timeout entry is
+ * set up by the slab constructor, everything after it is cleared on
+ * allocation. */
+struct rfcomm_dlc_ext {
+	struct rfcomm_dlc	d;
+	struct rfcomm_tmo	tmo;
+
+	/* Most RX credits the owner can absorb right now, derived from
+	 * its free receive space. -1 if the owner doesn't report it. */
+	int			rx_credits_max;
+
+	/* Called by krfcommd instead of kfree_skb() once a TX frame has
+	 * been handed to L2CAP, lets the owner recycle it. */
+	void (*tx_done)(struct rfcomm_dlc *d, struct sk_buff *skb);
+
+	/* Called without the DLC lock once per krfcommd RX pass for DLCs
+	 * that got data_ready() calls during the pass. */
+	void (*rx_flush)(struct rfcomm_dlc *d);
+	bool			rx_flush_pending;
+};
+
+#define rfcomm_dlc_ext(d) ((struct rfcomm_dlc_ext *) (d))
+
+struct rfcomm_skb_cb {
+	/* Paged UIH frames can't take the FCS at their tail,
+	 * it is kept here and sent by rfcomm_send_skb(). */
+	u8	fcs;
+
+	/* Payload length as queued by the owner, the core doesn't
+	 * touch it. Used for the owner's own TX accounting. */
+	u16	len;
+};
+
+#define rfcomm_skb_cb(skb) ((struct rfcomm_skb_cb *) ((skb)->cb))
+
+/* Report free receive space in bytes, CFC grants follow it */
+void rfcomm_dlc_set_rx_space(struct rfcomm_dlc *d, int space);
+
+/* Process the DLC's session RX queue in the caller's context */
+int rfcomm_dlc_busy_poll(struct rfcomm_dlc *d);
+
+#endif /* __RFCOMM_EXT_H */
@@ -31,6 +31,11 @@ static struct bt_sock_list rfcomm_sk_list = {
 	.lock = __RW_LOCK_UNLOCKED(rfcomm_sk_list.lock)
 };
 
+/* Bound and listening sockets hashed by server channel, linked through
+ * sk_bind_node. Connected sockets are only on rfcomm_sk_list. */
+static struct hlist_head rfcomm_chan_hash[RFCOMM_MAX_CHANNEL + 1];
+static DEFINE_RWLOCK(rfcomm_chan_lock);
+
 /* ---- DLC callbacks ----
  *
  * called under rfcomm_dlc_lock()
@@ -38,15 +43,22 @@ static struct bt_sock_list rfcomm_sk_list = {
 void RFCOMM_SOCK::rfcomm_sk_data_ready_cls(struct rfcomm_dlc *d, struct sk_buff *skb)
 {
 	struct sock *sk = d->owner;
+	int len;
+
 	if (!sk)
 		return;
 
-	atomic_add(skb->len, &sk->sk_rmem_alloc);
-	skb_queue_tail(&sk->sk_receive_queue, skb);
-	sk->sk_data_ready(sk, skb->len);
+	if (rfcomm_sk_ext(sk)->rx_ring) {
+		rfcomm_sock_ring_rcv(sk, skb);
+		return;
+	}
 
-	if (atomic_read(&sk->sk_rmem_alloc) >= sk->sk_rcvbuf)
-		rfcomm_dlc_throttle(d);
+	len = skb->len;
+
+	atomic_add(len, &sk->sk_rmem_alloc);
+	skb_queue_tail(&sk->sk_receive_queue, skb);
+	rfcomm_sock_data_wakeup(sk, len);
+	rfcomm_sock_rx_update(sk);
 }
 
 void RFCOMM_SOCK::rfcomm_sk_state_change_cls(struct rfcomm_dlc *d, int err)
@@ -93,13 +105,29 @@ void RFCOMM_SOCK::rfcomm_sk_state_change_cls(struct rfcomm_dlc *d, int err)
 }
 
 /* ---- Socket functions ---- */
+void RFCOMM_SOCK::__rfcomm_sock_hash(struct sock *sk)
+{
+	u8 channel = rfcomm_pi(sk)->channel;
+
+	BT_DBG("sk %p channel %d", sk, channel);
+
+	sk_add_bind_node(sk, &rfcomm_chan_hash[channel]);
+}
+
+void RFCOMM_SOCK::rfcomm_sock_unhash(struct sock *sk)
+{
+	write_lock(&rfcomm_chan_lock);
+	if (!hlist_unhashed(&sk->sk_bind_node))
+		hlist_del_init(&sk->sk_bind_node);
+	write_unlock(&rfcomm_chan_lock);
+}
+
 struct sock* RFCOMM_SOCK::__rfcomm_get_sock_by_addr(u8 channel, bdaddr_t *src)
 {
 	struct sock *sk = NULL;
 
-	sk_for_each(sk, NULL,&rfcomm_sk_list.head) {
-		if (rfcomm_pi(sk)->channel == channel &&
-				!bacmp(&bt_sk(sk)->src, src))
+	sk_for_each_bound(sk, NULL, &rfcomm_chan_hash[channel]) {
+		if (!bacmp(&bt_sk(sk)->src, src))
 			break;
 	}
 
@@ -113,24 +141,25 @@ struct sock* RFCOMM_SOCK::rfcomm_get_sock_by_channel(int state, u8 channel, bdad
 {
 	struct sock *sk = NULL, *sk1 = NULL;
 
-	read_lock(&rfcomm_sk_list.lock);
+	if (channel < 1 || channel > RFCOMM_MAX_CHANNEL)
+		return NULL;
 
-	sk_for_each(sk,NULL, &rfcomm_sk_list.head) {
+	read_lock(&rfcomm_chan_lock);
+
+	sk_for_each_bound(sk, NULL, &rfcomm_chan_hash[channel]) {
 		if (state && sk->sk_state != state)
 			continue;
 
-		if (rfcomm_pi(sk)->channel == channel) {
-			/* Exact match. */
-			if (!bacmp(&bt_sk(sk)->src, src))
-				break;
+		/* Exact match. */
+		if (!bacmp(&bt_sk(sk)->src, src))
+			break;
 
-			/* Closest match */
-			if (!bacmp(&bt_sk(sk)->src, BDADDR_ANY))
-				sk1 = sk;
-		}
+		/* Closest match */
+		if (!bacmp(&bt_sk(sk)->src, BDADDR_ANY))
+			sk1 = sk;
 	}
 
-	read_unlock(&rfcomm_sk_list.lock);
+	read_unlock(&rfcomm_chan_lock);
 
 	return sk ? sk : sk1;
 }
@@ -144,6 +173,9 @@ void RFCOMM_SOCK::rfcomm_sock_destruct_cls(struct sock *sk)
 	skb_queue_purge(&sk->sk_receive_queue);
 	skb_queue_purge(&sk->sk_write_queue);
 
+	kfree_skb(rfcomm_sk_ext(sk)->tx_skb);
+	vfree(rfcomm_sk_ext(sk)->rx_ring);
+
 	rfcomm_dlc_lock(d);
 	rfcomm_pi(sk)->dlc = NULL;
 
@@ -167,10 +199,457 @@ void RFCOMM_SOCK::rfcomm_sock_cleanup_listen(struct sock *parent)
 		rfcomm_sock_kill(sk);
 	}
 
+	rfcomm_sock_pool_purge(parent);
+
 	parent->sk_state  = BT_CLOSED;
 	sock_set_flag(parent, SOCK_ZAPPED);
 }
 
+/* ---- Accept pool ---- */
+void RFCOMM_SOCK::rfcomm_sock_pool_refill(struct sock *parent)
+{
+	sock_hold(parent);
+	if (!schedule_work(&rfcomm_sk_ext(parent)->pool_work))
+		sock_put(parent);
+}
+
+void RFCOMM_SOCK::rfcomm_sock_pool_work_cls(struct work_struct *work)
+{
+	struct rfcomm_sock_ext *ext = container_of(work, struct rfcomm_sock_ext, pool_work);
+	struct sock *parent = (struct sock *) ext, *sk;
+	bool full;
+
+	BT_DBG("parent %p len %u size %u", parent, ext->pool_len, ext->pool_size);
+
+	while (1) {
+		spin_lock_bh(&ext->pool_lock);
+		full = ext->pool_len >= ext->pool_size;
+		spin_unlock_bh(&ext->pool_lock);
+
+		if (full)
+			break;
+
+		sk = rfcomm_sock_alloc(sock_net(parent), NULL, BTPROTO_RFCOMM, GFP_KERNEL);
+		if (!sk)
+			break;
+
+		bt_sock_reclassify_lock(sk, BTPROTO_RFCOMM);
+
+		spin_lock_bh(&ext->pool_lock);
+		if (ext->pool_len < ext->pool_size) {
+			list_add_tail(&rfcomm_sk_ext(sk)->pool_node, &ext->pool);
+			ext->pool_len++;
+			sk = NULL;
+		}
+		spin_unlock_bh(&ext->pool_lock);
+
+		/* Pool was shrunk or purged meanwhile */
+		if (sk) {
+			sock_set_flag(sk, SOCK_ZAPPED);
+			rfcomm_sock_kill(sk);
+			break;
+		}
+	}
+
+	sock_put(parent);
+}
+
+/* Take a ready child socket off the pool and kick a refill.
+ * Called from rfcomm_connect_ind(), must not sleep.
+ */
+struct sock* RFCOMM_SOCK::rfcomm_sock_pool_get(struct sock *parent)
+{
+	struct rfcomm_sock_ext *ext = rfcomm_sk_ext(parent), *child;
+	struct sock *sk = NULL;
+	bool refill;
+
+	spin_lock_bh(&ext->pool_lock);
+
+	if (!list_empty(&ext->pool)) {
+		child = list_first_entry(&ext->pool, struct rfcomm_sock_ext, pool_node);
+		list_del_init(&child->pool_node);
+		ext->pool_len--;
+		sk = (struct sock *) child;
+	}
+
+	refill = ext->pool_len < ext->pool_size;
+
+	spin_unlock_bh(&ext->pool_lock);
+
+	if (refill)
+		rfcomm_sock_pool_refill(parent);
+
+	return sk;
+}
+
+/* Resize the pool, children beyond the new size are killed */
+void RFCOMM_SOCK::rfcomm_sock_pool_trim(struct sock *parent, unsigned int size)
+{
+	struct rfcomm_sock_ext *ext = rfcomm_sk_ext(parent), *child, *n;
+	LIST_HEAD(pool);
+
+	spin_lock_bh(&ext->pool_lock);
+	ext->pool_size = size;
+	while (ext->pool_len > size) {
+		child = list_entry(ext->pool.prev, struct rfcomm_sock_ext, pool_node);
+		list_move(&child->pool_node, &pool);
+		ext->pool_len--;
+	}
+	spin_unlock_bh(&ext->pool_lock);
+
+	list_for_each_entry_safe(child, n, &pool, pool_node) {
+		struct sock *sk = (struct sock *) child;
+
+		list_del_init(&child->pool_node);
+		sock_set_flag(sk, SOCK_ZAPPED);
+		rfcomm_sock_kill(sk);
+	}
+}
+
+void RFCOMM_SOCK::rfcomm_sock_pool_purge(struct sock *parent)
+{
+	struct rfcomm_sock_ext *ext = rfcomm_sk_ext(parent);
+
+	rfcomm_sock_pool_trim(parent, 0);
+
+	if (cancel_work_sync(&ext->pool_work))
+		sock_put(parent);
+}
+
+/* ---- Write coalescing ---- */
+
+/* tx_lock is held across the send, a writer that finds no tail skb
+ * meanwhile can't get a newer frame queued ahead of this one. */
+void RFCOMM_SOCK::rfcomm_sock_flush(struct sock *sk)
+{
+	struct rfcomm_sock_ext *ext = rfcomm_sk_ext(sk);
+	struct sk_buff *skb;
+
+	spin_lock_bh(&ext->tx_lock);
+	skb = ext->tx_skb;
+	ext->tx_skb = NULL;
+	if (skb) {
+		BT_DBG("sk %p len %d", sk, skb->len);
+
+		if (rfcomm_dlc_send(rfcomm_pi(sk)->dlc, skb) >= 0)
+			skb = NULL;
+	}
+	spin_unlock_bh(&ext->tx_lock);
+
+	kfree_skb(skb);
+}
+
+void RFCOMM_SOCK::rfcomm_sock_flush_timeout_cls(unsigned long arg)
+{
+	struct sock *sk = (struct sock *) arg;
+
+	BT_DBG("sk %p", sk);
+
+	rfcomm_sock_flush(sk);
+	sock_put(sk);
+}
+
+/* Append to the partially filled tail skb, only full frames are sent
+ * right away. Called with the socket locked. */
+int RFCOMM_SOCK::rfcomm_sock_sendmsg_coalesce(struct sock *sk, struct msghdr *msg, size_t len)
+{
+	struct rfcomm_sock_ext *ext = rfcomm_sk_ext(sk);
+	struct rfcomm_dlc *d = rfcomm_pi(sk)->dlc;
+	struct sk_buff *skb;
+	int sent = 0;
+
+	if (sk->sk_state != BT_CONNECTED)
+		return -ENOTCONN;
+
+	while (len) {
+		size_t size;
+		int err;
+
+		/* Own the tail skb while filling it, the flush timer
+		 * finds nothing to send meanwhile. */
+		spin_lock_bh(&ext->tx_lock);
+		skb = ext->tx_skb;
+		ext->tx_skb = NULL;
+		spin_unlock_bh(&ext->tx_lock);
+
+		if (!skb) {
+			skb = sock_alloc_send_skb(sk, d->mtu + RFCOMM_SKB_RESERVE,
+					msg->msg_flags & MSG_DONTWAIT, &err);
+			if (!skb) {
+				if (sent == 0)
+					sent = err;
+				break;
+			}
+			skb_reserve(skb, RFCOMM_SKB_HEAD_RESERVE);
+			sock_tx_timestamp(sk, &skb_shinfo(skb)->tx_flags);
+			skb->priority = sk->sk_priority;
+		}
+
+		size = min_t(size_t, len, d->mtu - skb->len);
+
+		err = memcpy_fromiovec(skb_put(skb, size), msg->msg_iov, size);
+		if (err) {
+			skb_trim(skb, skb->len - size);
+			if (sent == 0)
+				sent = err;
+		} else {
+			sent += size;
+			len  -= size;
+		}
+
+		if (skb->len < d->mtu) {
+			if (!skb->len) {
+				kfree_skb(skb);
+				break;
+			}
+
+			spin_lock_bh(&ext->tx_lock);
+			ext->tx_skb = skb;
+			spin_unlock_bh(&ext->tx_lock);
+
+			if (!timer_pending(&ext->tx_timer))
+				sk_reset_timer(sk, &ext->tx_timer,
+					jiffies + msecs_to_jiffies(ext->coalesce));
+			if (err)
+				break;
+			continue;
+		}
+
+		err = rfcomm_dlc_send(d, skb);
+		if (err < 0) {
+			kfree_skb(skb);
+			if (sent == 0)
+				sent = err;
+			break;
+		}
+	}
+
+	return sent;
+}
+
+/* ---- RX backpressure ---- */
+
+/* Called whenever the amount of queued data changes */
+void RFCOMM_SOCK::rfcomm_sock_rx_update(struct sock *sk)
+{
+	struct rfcomm_sock_ext *ext = rfcomm_sk_ext(sk);
+	struct rfcomm_dlc *d = rfcomm_pi(sk)->dlc;
+	int high = sk->sk_rcvbuf / 100 * ext->rx_high;
+	int low  = sk->sk_rcvbuf / 100 * ext->rx_low;
+	int queued = atomic_read(&sk->sk_rmem_alloc);
+
+	rfcomm_dlc_set_rx_space(d, high - queued);
+
+	if (queued >= high)
+		rfcomm_dlc_throttle(d);
+	else if (queued <= low)
+		rfcomm_dlc_unthrottle(d);
+}
+
+/* Spin on the session's L2CAP queue instead of sleeping until
+ * krfcommd gets to run. Must be called on unlocked socket. */
+void RFCOMM_SOCK::rfcomm_sock_busy_poll(struct sock *sk, int nonblock)
+{
+	struct rfcomm_dlc *d = rfcomm_pi(sk)->dlc;
+	u64 end = local_clock() + (u64) rfcomm_sk_ext(sk)->busy_poll * NSEC_PER_USEC;
+
+	do {
+		if (!skb_queue_empty(&sk->sk_receive_queue))
+			break;
+
+		if (sk->sk_state != BT_CONNECTED || sk->sk_err)
+			break;
+
+		rfcomm_dlc_busy_poll(d);
+
+		if (nonblock || signal_pending(current) || need_resched())
+			break;
+
+		cpu_relax();
+	} while (local_clock() < end);
+}
+
+/* ---- Reader wakeup ---- */
+bool RFCOMM_SOCK::rfcomm_sock_readable(struct sock *sk)
+{
+	struct rfcomm_sock_ext *ext = rfcomm_sk_ext(sk);
+	u32 queued;
+
+	if (sk->sk_shutdown & RCV_SHUTDOWN)
+		return true;
+
+	if (ext->rx_ring)
+		queued = ext->rx_head - ACCESS_ONCE(ext->rx_ring->tail);
+	else if (!skb_queue_empty(&sk->sk_receive_queue))
+		queued = atomic_read(&sk->sk_rmem_alloc);
+	else
+		queued = 0;
+
+	/* Drained, the next partial read has to wait again */
+	if (!queued) {
+		ext->rcv_expired = false;
+		return false;
+	}
+
+	return queued >= sk->sk_rcvlowat || ext->rcv_expired;
+}
+
+/* Called for every received frame instead of sk_data_ready */
+void RFCOMM_SOCK::rfcomm_sock_data_wakeup(struct sock *sk, int len)
+{
+	struct rfcomm_sock_ext *ext = rfcomm_sk_ext(sk);
+
+	if (rfcomm_sock_readable(sk)) {
+		if (ext->rcv_defer)
+			sk_stop_timer(sk, &ext->rcv_timer);
+		sk->sk_data_ready(sk, len);
+		return;
+	}
+
+	if (ext->rcv_defer && !timer_pending(&ext->rcv_timer))
+		sk_reset_timer(sk, &ext->rcv_timer,
+				jiffies + msecs_to_jiffies(ext->rcv_defer));
+}
+
+void RFCOMM_SOCK::rfcomm_sock_rcv_timeout_cls(unsigned long arg)
+{
+	struct sock *sk = (struct sock *) arg;
+
+	BT_DBG("sk %p", sk);
+
+	rfcomm_sk_ext(sk)->rcv_expired = true;
+	sk->sk_data_ready(sk, 0);
+	sock_put(sk);
+}
+
+/* ---- RX ring ---- */
+
+/* Copy the frame into the ring, -ENOSPC if it doesn't fit.
+ * Called under rx_lock. */
+int RFCOMM_SOCK::rfcomm_sock_ring_put(struct sock *sk, struct sk_buff *skb)
+{
+	struct rfcomm_sock_ext *ext = rfcomm_sk_ext(sk);
+	u8 *data = (u8 *) ext->rx_ring + RFCOMM_RX_RING_DATA;
+	u32 head = ext->rx_head, used, off, len;
+
+	used = head - ACCESS_ONCE(ext->rx_ring->tail);
+
+	/* The reader must be done with the data before tail, pairs with
+	 * its barrier before it stores tail */
+	smp_mb();
+
+	/* A bogus tail from userspace just looks like a full ring */
+	if (used > ext->rx_size || ext->rx_size - used < skb->len)
+		return -ENOSPC;
+
+	off = head & (ext->rx_size - 1);
+	len = min_t(u32, skb->len, ext->rx_size - off);
+
+	skb_copy_bits(skb, 0, data + off, len);
+	if (len < skb->len)
+		skb_copy_bits(skb, len, data, skb->len - len);
+
+	/* Data must be visible before the new head */
+	smp_wmb();
+
+	ext->rx_head = head + skb->len;
+	ext->rx_ring->head = ext->rx_head;
+	return 0;
+}
+
+/* Frames that don't fit are parked on sk_receive_queue and the DLC is
+ * throttled until rfcomm_sock_ring_fill() moves them into the ring. */
+void RFCOMM_SOCK::rfcomm_sock_ring_rcv(struct sock *sk, struct sk_buff *skb)
+{
+	struct rfcomm_sock_ext *ext = rfcomm_sk_ext(sk);
+	int len = skb->len;
+
+	spin_lock_bh(&ext->rx_lock);
+	atomic_add(len, &sk->sk_rmem_alloc);
+	skb_queue_tail(&sk->sk_receive_queue, skb);
+	spin_unlock_bh(&ext->rx_lock);
+
+	/* Parked frames go first, the reader may have freed space */
+	rfcomm_sock_ring_fill(sk);
+
+	rfcomm_sock_data_wakeup(sk, len);
+}
+
+void RFCOMM_SOCK::rfcomm_sock_ring_fill(struct sock *sk)
+{
+	struct rfcomm_sock_ext *ext = rfcomm_sk_ext(sk);
+	struct sk_buff *skb;
+	bool empty;
+
+	spin_lock_bh(&ext->rx_lock);
+
+	while ((skb = skb_peek(&sk->sk_receive_queue))) {
+		if (rfcomm_sock_ring_put(sk, skb))
+			break;
+
+		skb_unlink(skb, &sk->sk_receive_queue);
+		atomic_sub(skb->len, &sk->sk_rmem_alloc);
+		kfree_skb(skb);
+	}
+
+	empty = skb_queue_empty(&sk->sk_receive_queue);
+
+	spin_unlock_bh(&ext->rx_lock);
+
+	if (empty) {
+		rfcomm_dlc_unthrottle(rfcomm_pi(sk)->dlc);
+		return;
+	}
+
+	rfcomm_dlc_throttle(rfcomm_pi(sk)->dlc);
+
+	if (!timer_pending(&ext->rx_timer))
+		sk_reset_timer(sk, &ext->rx_timer,
+				jiffies + RFCOMM_RX_RING_RETRY);
+}
+
+void RFCOMM_SOCK::rfcomm_sock_ring_timeout_cls(unsigned long arg)
+{
+	struct sock *sk = (struct sock *) arg;
+
+	BT_DBG("sk %p", sk);
+
+	rfcomm_sock_ring_fill(sk);
+	sock_put(sk);
+}
+
+/* Called with the socket locked */
+int RFCOMM_SOCK::rfcomm_sock_ring_setup(struct sock *sk, u32 size)
+{
+	struct rfcomm_sock_ext *ext = rfcomm_sk_ext(sk);
+	struct rfcomm_rx_ring *ring;
+
+	if (ext->rx_ring)
+		return -EBUSY;
+
+	if (!is_power_of_2(size) || size < RFCOMM_RX_RING_MIN ||
+					size > RFCOMM_RX_RING_MAX)
+		return -EINVAL;
+
+	ring = (struct rfcomm_rx_ring *) vmalloc_user(RFCOMM_RX_RING_DATA + size);
+	if (!ring)
+		return -ENOMEM;
+
+	ring->size = size;
+
+	BT_DBG("sk %p ring %p size %u", sk, ring, size);
+
+	spin_lock_bh(&ext->rx_lock);
+	ext->rx_size = size;
+	ext->rx_head = 0;
+	ext->rx_ring = ring;
+	spin_unlock_bh(&ext->rx_lock);
+
+	/* Move whatever was received before */
+	rfcomm_sock_ring_fill(sk);
+	return 0;
+}
+
 /* Kill socket (only if zapped and orphan)
  * Must be called on unlocked socket.
  */
@@ -182,6 +661,7 @@ void RFCOMM_SOCK::rfcomm_sock_kill(struct sock *sk)
 	BT_DBG("sk %p state %d refcnt %d", sk, sk->sk_state, atomic_read(&sk->sk_refcnt));
 
 	/* Kill poor orphan */
+	rfcomm_sock_unhash(sk);
 	bt_sock_unlink(&rfcomm_sk_list, sk);
 	sock_set_flag(sk, SOCK_DEAD);
 	sock_put(sk);
@@ -193,15 +673,26 @@ void RFCOMM_SOCK::__rfcomm_sock_close(struct sock *sk)
 
 	BT_DBG("sk %p state %d socket %p", sk, sk->sk_state, sk->sk_socket);
 
+	rfcomm_sock_unhash(sk);
+	sk_stop_timer(sk, &rfcomm_sk_ext(sk)->rcv_timer);
+	sk_stop_timer(sk, &rfcomm_sk_ext(sk)->rx_timer);
+
 	switch (sk->sk_state) {
 	case BT_LISTEN:
 		rfcomm_sock_cleanup_listen(sk);
 		break;
 
+	case BT_CONNECTED:
+		/* Push out coalesced data ahead of the DISC. Wait for a
+		 * flush that is already running, it queues before us. */
+		if (del_timer_sync(&rfcomm_sk_ext(sk)->tx_timer))
+			__sock_put(sk);
+		rfcomm_sock_flush(sk);
+		/* Fall through */
+
 	case BT_CONNECT:
 	case BT_CONNECT2:
 	case BT_CONFIG:
-	case BT_CONNECTED:
 		rfcomm_dlc_close(d, 0);
 
 	default:
@@ -234,6 +725,9 @@ void RFCOMM_SOCK::rfcomm_sock_init(struct sock *sk, struct sock *parent)
 		pi->sec_level = rfcomm_pi(parent)->sec_level;
 		pi->role_switch = rfcomm_pi(parent)->role_switch;
 
+		rfcomm_sk_ext(sk)->rx_high = rfcomm_sk_ext(parent)->rx_high;
+		rfcomm_sk_ext(sk)->rx_low  = rfcomm_sk_ext(parent)->rx_low;
+
 		security_sk_clone(parent, sk);
 	} else {
 		pi->dlc->defer_setup = 0;
@@ -258,6 +752,25 @@ struct sock* RFCOMM_SOCK::rfcomm_sock_alloc(struct net *net, struct socket *sock
 	sock_init_data(sock, sk);
 	INIT_LIST_HEAD(&bt_sk(sk)->accept_q);
 
+	spin_lock_init(&rfcomm_sk_ext(sk)->pool_lock);
+	INIT_LIST_HEAD(&rfcomm_sk_ext(sk)->pool);
+	INIT_LIST_HEAD(&rfcomm_sk_ext(sk)->pool_node);
+	INIT_WORK(&rfcomm_sk_ext(sk)->pool_work, rfcomm_sock_pool_work);
+
+	spin_lock_init(&rfcomm_sk_ext(sk)->tx_lock);
+	setup_timer(&rfcomm_sk_ext(sk)->tx_timer, rfcomm_sock_flush_timeout,
+			(unsigned long) sk);
+
+	spin_lock_init(&rfcomm_sk_ext(sk)->rx_lock);
+	setup_timer(&rfcomm_sk_ext(sk)->rx_timer, rfcomm_sock_ring_timeout,
+			(unsigned long) sk);
+
+	setup_timer(&rfcomm_sk_ext(sk)->rcv_timer, rfcomm_sock_rcv_timeout,
+			(unsigned long) sk);
+
+	rfcomm_sk_ext(sk)->rx_high = RFCOMM_RX_WMARK_HIGH;
+	rfcomm_sk_ext(sk)->rx_low  = RFCOMM_RX_WMARK_LOW;
+
 	d = rfcomm_dlc_alloc(prio);
 	if (!d) {
 		sk_free(sk);
@@ -296,7 +809,8 @@ int RFCOMM_SOCK::rfcomm_sock_create(struct net *net, struct socket *sock,
 
 	sock->state = SS_UNCONNECTED;
 
-	if (sock->type != SOCK_STREAM && sock->type != SOCK_RAW)
+	if (sock->type != SOCK_STREAM && sock->type != SOCK_SEQPACKET &&
+					sock->type != SOCK_RAW)
 		return -ESOCKTNOSUPPORT;
 
 	sock->ops = &rfcomm_sock_ops;
@@ -327,12 +841,17 @@ int RFCOMM_SOCK::rfcomm_sock_bind(struct socket *sock, struct sockaddr *addr, in
 		goto done;
 	}
 
-	if (sk->sk_type != SOCK_STREAM) {
+	if (sk->sk_type != SOCK_STREAM && sk->sk_type != SOCK_SEQPACKET) {
+		err = -EINVAL;
+		goto done;
+	}
+
+	if (sa->rc_channel > RFCOMM_MAX_CHANNEL) {
 		err = -EINVAL;
 		goto done;
 	}
 
-	write_lock(&rfcomm_sk_list.lock);
+	write_lock(&rfcomm_chan_lock);
 
 	if (sa->rc_channel && __rfcomm_get_sock_by_addr(sa->rc_channel, &sa->rc_bdaddr)) {
 		err = -EADDRINUSE;
@@ -341,9 +860,12 @@ int RFCOMM_SOCK::rfcomm_sock_bind(struct socket *sock, struct sockaddr *addr, in
 		bacpy(&bt_sk(sk)->src, &sa->rc_bdaddr);
 		rfcomm_pi(sk)->channel = sa->rc_channel;
 		sk->sk_state = BT_BOUND;
+
+		if (sa->rc_channel)
+			__rfcomm_sock_hash(sk);
 	}
 
-	write_unlock(&rfcomm_sk_list.lock);
+	write_unlock(&rfcomm_chan_lock);
 
 done:
 	release_sock(sk);
@@ -370,11 +892,14 @@ int RFCOMM_SOCK::rfcomm_sock_connect(struct socket *sock, struct sockaddr *addr,
 		goto done;
 	}
 
-	if (sk->sk_type != SOCK_STREAM) {
+	if (sk->sk_type != SOCK_STREAM && sk->sk_type != SOCK_SEQPACKET) {
 		err = -EINVAL;
 		goto done;
 	}
 
+	/* Channel now names the remote side, drop the bind reservation */
+	rfcomm_sock_unhash(sk);
+
 	sk->sk_state = BT_CONNECT;
 	bacpy(&bt_sk(sk)->dst, &sa->rc_bdaddr);
 	rfcomm_pi(sk)->channel = sa->rc_channel;
@@ -406,7 +931,7 @@ int RFCOMM_SOCK::rfcomm_sock_listen(struct socket *sock, int backlog)
 		goto done;
 	}
 
-	if (sk->sk_type != SOCK_STREAM) {
+	if (sk->sk_type != SOCK_STREAM && sk->sk_type != SOCK_SEQPACKET) {
 		err = -EINVAL;
 		goto done;
 	}
@@ -417,16 +942,17 @@ int RFCOMM_SOCK::rfcomm_sock_listen(struct socket *sock, int backlog)
 
 		err = -EINVAL;
 
-		write_lock(&rfcomm_sk_list.lock);
+		write_lock(&rfcomm_chan_lock);
 
-		for (channel = 1; channel < 31; channel++)
+		for (channel = 1; channel <= RFCOMM_MAX_CHANNEL; channel++)
 			if (!__rfcomm_get_sock_by_addr(channel, src)) {
 				rfcomm_pi(sk)->channel = channel;
+				__rfcomm_sock_hash(sk);
 				err = 0;
 				break;
 			}
 
-		write_unlock(&rfcomm_sk_list.lock);
+		write_unlock(&rfcomm_chan_lock);
 
 		if (err < 0)
 			goto done;
@@ -436,6 +962,9 @@ int RFCOMM_SOCK::rfcomm_sock_listen(struct socket *sock, int backlog)
 	sk->sk_ack_backlog = 0;
 	sk->sk_state = BT_LISTEN;
 
+	if (rfcomm_sk_ext(sk)->pool_size)
+		rfcomm_sock_pool_refill(sk);
+
 done:
 	release_sock(sk);
 	return err;
@@ -452,7 +981,7 @@ int RFCOMM_SOCK::rfcomm_sock_accept(struct socket *sock, struct socket *newsock,
 
 	lock_sock_nested(sk, SINGLE_DEPTH_NESTING);
 
-	if (sk->sk_type != SOCK_STREAM) {
+	if (sk->sk_type != SOCK_STREAM && sk->sk_type != SOCK_SEQPACKET) {
 		err = -EINVAL;
 		goto done;
 	}
@@ -544,6 +1073,18 @@ int RFCOMM_SOCK::rfcomm_sock_sendmsg(struct kiocb *iocb, struct socket *sock,
 
 	lock_sock(sk);
 
+	/* One record per UIH frame */
+	if (sk->sk_type == SOCK_SEQPACKET && len > d->mtu) {
+		release_sock(sk);
+		return -EMSGSIZE;
+	}
+
+	if (rfcomm_sk_ext(sk)->coalesce) {
+		sent = rfcomm_sock_sendmsg_coalesce(sk, msg, len);
+		release_sock(sk);
+		return sent;
+	}
+
 	while (len) {
 		size_t size = min_t(size_t, len, d->mtu);
 		int err;
@@ -556,6 +1097,7 @@ int RFCOMM_SOCK::rfcomm_sock_sendmsg(struct kiocb *iocb, struct socket *sock,
 			break;
 		}
 		skb_reserve(skb, RFCOMM_SKB_HEAD_RESERVE);
+		sock_tx_timestamp(sk, &skb_shinfo(skb)->tx_flags);
 
 		err = memcpy_fromiovec(skb_put(skb, size), msg->msg_iov, size);
 		if (err) {
@@ -584,27 +1126,216 @@ int RFCOMM_SOCK::rfcomm_sock_sendmsg(struct kiocb *iocb, struct socket *sock,
 	return sent;
 }
 
+/* Frames reference the caller's page, the payload is only read
+ * when krfcommd hands the frame to L2CAP. */
+ssize_t RFCOMM_SOCK::rfcomm_sock_sendpage(struct socket *sock, struct page *page,
+				int offset, size_t size, int flags)
+{
+	struct sock *sk = sock->sk;
+	struct rfcomm_dlc *d = rfcomm_pi(sk)->dlc;
+	struct sk_buff *skb;
+	ssize_t sent = 0;
+
+	if (test_bit(RFCOMM_DEFER_SETUP, &d->flags))
+		return -ENOTCONN;
+
+	if (flags & MSG_OOB)
+		return -EOPNOTSUPP;
+
+	if (sk->sk_shutdown & SEND_SHUTDOWN)
+		return -EPIPE;
+
+	BT_DBG("sock %p, sk %p offset %d size %zu", sock, sk, offset, size);
+
+	lock_sock(sk);
+
+	if (sk->sk_type == SOCK_SEQPACKET && size > d->mtu) {
+		release_sock(sk);
+		return -EMSGSIZE;
+	}
+
+	/* Keep the byte stream in order */
+	rfcomm_sock_flush(sk);
+
+	while (size) {
+		size_t len = min_t(size_t, size, d->mtu);
+		int err;
+
+		skb = sock_alloc_send_skb(sk, RFCOMM_SKB_HEAD_RESERVE,
+				flags & MSG_DONTWAIT, &err);
+		if (!skb) {
+			if (sent == 0)
+				sent = err;
+			break;
+		}
+		skb_reserve(skb, RFCOMM_SKB_HEAD_RESERVE);
+		sock_tx_timestamp(sk, &skb_shinfo(skb)->tx_flags);
+
+		get_page(page);
+		skb_fill_page_desc(skb, 0, page, offset, len);
+
+		skb->len      += len;
+		skb->data_len += len;
+		skb->truesize += len;
+		atomic_add(len, &sk->sk_wmem_alloc);
+
+		skb->priority = sk->sk_priority;
+
+		err = rfcomm_dlc_send(d, skb);
+		if (err < 0) {
+			kfree_skb(skb);
+			if (sent == 0)
+				sent = err;
+			break;
+		}
+
+		sent   += len;
+		offset += len;
+		size   -= len;
+	}
+
+	release_sock(sk);
+
+	return sent;
+}
+
+/* MSG_ERRQUEUE receive, returns TX timestamps queued by
+ * rfcomm_process_tx(). */
+int RFCOMM_SOCK::rfcomm_sock_recv_errqueue(struct sock *sk, struct msghdr *msg, size_t size)
+{
+	struct sock_exterr_skb *serr;
+	struct sk_buff *skb, *skb2;
+	int copied, err;
+
+	skb = skb_dequeue(&sk->sk_error_queue);
+	if (!skb)
+		return -EAGAIN;
+
+	copied = skb->len;
+	if (size < copied) {
+		msg->msg_flags |= MSG_TRUNC;
+		copied = size;
+	}
+
+	err = skb_copy_datagram_iovec(skb, 0, msg->msg_iov, copied);
+	if (err)
+		goto done;
+
+	sock_recv_timestamp(msg, sk, skb);
+
+	serr = SKB_EXT_ERR(skb);
+	put_cmsg(msg, SOL_RFCOMM, RFCOMM_TX_TIMESTAMP,
+			sizeof(serr->ee), &serr->ee);
+
+	msg->msg_flags |= MSG_ERRQUEUE;
+	err = copied;
+
+	/* Reset and regenerate socket error */
+	spin_lock_bh(&sk->sk_error_queue.lock);
+	sk->sk_err = 0;
+	skb2 = skb_peek(&sk->sk_error_queue);
+	if (skb2) {
+		sk->sk_err = SKB_EXT_ERR(skb2)->ee.ee_errno;
+		spin_unlock_bh(&sk->sk_error_queue.lock);
+		sk->sk_error_report(sk);
+	} else {
+		spin_unlock_bh(&sk->sk_error_queue.lock);
+	}
+
+done:
+	kfree_skb(skb);
+	return err;
+}
+
+/* SOCK_SEQPACKET receive, each queued skb is one UIH frame and is
+ * returned as one record. */
+int RFCOMM_SOCK::rfcomm_sock_recv_record(struct sock *sk, struct msghdr *msg, size_t size, int flags)
+{
+	struct sk_buff *skb;
+	int copied, err;
+
+	skb = skb_recv_datagram(sk, flags, flags & MSG_DONTWAIT, &err);
+	if (!skb) {
+		if (sk->sk_shutdown & RCV_SHUTDOWN)
+			return 0;
+		return err;
+	}
+
+	msg->msg_namelen = 0;
+
+	copied = skb->len;
+	if (size < copied) {
+		msg->msg_flags |= MSG_TRUNC;
+		copied = size;
+	}
+
+	err = skb_copy_datagram_iovec(skb, 0, msg->msg_iov, copied);
+	if (!err)
+		sock_recv_ts_and_drops(msg, sk, skb);
+
+	lock_sock(sk);
+	if (!(flags & MSG_PEEK))
+		atomic_sub(skb->len, &sk->sk_rmem_alloc);
+
+	rfcomm_sock_rx_update(sk);
+	release_sock(sk);
+
+	if (!err && (flags & MSG_TRUNC))
+		copied = skb->len;
+
+	skb_free_datagram(sk, skb);
+
+	return err ? : copied;
+}
+
 int RFCOMM_SOCK::rfcomm_sock_recvmsg(struct kiocb *iocb, struct socket *sock,
 			       struct msghdr *msg, size_t size, int flags)
 {
 	struct sock *sk = sock->sk;
 	struct rfcomm_dlc *d = rfcomm_pi(sk)->dlc;
+	long timeo;
 	int len;
 
+	if (flags & MSG_ERRQUEUE)
+		return rfcomm_sock_recv_errqueue(sk, msg, size);
+
 	if (test_and_clear_bit(RFCOMM_DEFER_SETUP, &d->flags)) {
 		rfcomm_dlc_accept(d);
 		msg->msg_namelen = 0;
 		return 0;
 	}
 
+	/* Data is only delivered through the ring once it is set up */
+	if (rfcomm_sk_ext(sk)->rx_ring)
+		return -EBUSY;
+
+	if (rfcomm_sk_ext(sk)->busy_poll)
+		rfcomm_sock_busy_poll(sk, flags & MSG_DONTWAIT);
+
+	if (sk->sk_type == SOCK_SEQPACKET)
+		return rfcomm_sock_recv_record(sk, msg, size, flags);
+
+	/* bt_sock_stream_recvmsg() waits for all of sk_rcvlowat. Wait here
+	 * instead, so that an expired rcv_defer returns the smaller amount,
+	 * then take whatever is queued without blocking again. */
+	if (rfcomm_sk_ext(sk)->rcv_defer && !(flags & (MSG_DONTWAIT | MSG_WAITALL))) {
+		timeo = wait_event_interruptible_timeout(*sk_sleep(sk),
+				rfcomm_sock_readable(sk) || sk->sk_err ||
+				sk->sk_state != BT_CONNECTED,
+				sock_rcvtimeo(sk, 0));
+		if (timeo < 0)
+			return timeo;
+
+		flags |= MSG_DONTWAIT;
+	}
+
 	len = bt_sock_stream_recvmsg(iocb, sock, msg, size, flags);
 
 	lock_sock(sk);
 	if (!(flags & MSG_PEEK) && len > 0)
 		atomic_sub(len, &sk->sk_rmem_alloc);
 
-	if (atomic_read(&sk->sk_rmem_alloc) <= (sk->sk_rcvbuf >> 2))
-		rfcomm_dlc_unthrottle(rfcomm_pi(sk)->dlc);
+	rfcomm_sock_rx_update(sk);
 	release_sock(sk);
 
 	return len;
@@ -613,6 +1344,7 @@ int RFCOMM_SOCK::rfcomm_sock_recvmsg(struct kiocb *iocb, struct socket *sock,
 int RFCOMM_SOCK::rfcomm_sock_setsockopt_old(struct socket *sock, int optname, char __user *optval, unsigned int optlen)
 {
 	struct sock *sk = sock->sk;
+	struct rfcomm_rx_wmark wmark;
 	int err = 0;
 	u32 opt;
 
@@ -637,6 +1369,121 @@ int RFCOMM_SOCK::rfcomm_sock_setsockopt_old(struct socket *sock, int optname, ch
 		rfcomm_pi(sk)->role_switch = (opt & RFCOMM_LM_MASTER);
 		break;
 
+	case RFCOMM_ACCEPT_POOL:
+		if (get_user(opt, (u32 __user *) optval)) {
+			err = -EFAULT;
+			break;
+		}
+
+		if (opt > RFCOMM_ACCEPT_POOL_MAX) {
+			err = -EINVAL;
+			break;
+		}
+
+		rfcomm_sock_pool_trim(sk, opt);
+
+		if (sk->sk_state == BT_LISTEN)
+			rfcomm_sock_pool_refill(sk);
+		break;
+
+	case RFCOMM_COALESCE:
+		if (get_user(opt, (u32 __user *) optval)) {
+			err = -EFAULT;
+			break;
+		}
+
+		if (opt > RFCOMM_COALESCE_MAX ||
+				(opt && sk->sk_type == SOCK_SEQPACKET)) {
+			err = -EINVAL;
+			break;
+		}
+
+		rfcomm_sk_ext(sk)->coalesce = opt;
+		if (!opt) {
+			sk_stop_timer(sk, &rfcomm_sk_ext(sk)->tx_timer);
+			rfcomm_sock_flush(sk);
+		}
+		break;
+
+	case RFCOMM_FLUSH:
+		sk_stop_timer(sk, &rfcomm_sk_ext(sk)->tx_timer);
+		rfcomm_sock_flush(sk);
+		break;
+
+	case RFCOMM_RCV_DEFER:
+		if (get_user(opt, (u32 __user *) optval)) {
+			err = -EFAULT;
+			break;
+		}
+
+		if (opt > RFCOMM_RCV_DEFER_MAX) {
+			err = -EINVAL;
+			break;
+		}
+
+		rfcomm_sk_ext(sk)->rcv_defer = opt;
+		if (!opt)
+			sk_stop_timer(sk, &rfcomm_sk_ext(sk)->rcv_timer);
+		break;
+
+	case RFCOMM_BUSY_POLL:
+		if (get_user(opt, (u32 __user *) optval)) {
+			err = -EFAULT;
+			break;
+		}
+
+		if (opt > RFCOMM_BUSY_POLL_MAX) {
+			err = -EINVAL;
+			break;
+		}
+
+		/* Same rule as SO_BUSY_POLL */
+		if (opt > rfcomm_sk_ext(sk)->busy_poll && !capable(CAP_NET_ADMIN)) {
+			err = -EPERM;
+			break;
+		}
+
+		rfcomm_sk_ext(sk)->busy_poll = opt;
+		break;
+
+	case RFCOMM_RX_WMARK:
+		if (optlen < sizeof(wmark)) {
+			err = -EINVAL;
+			break;
+		}
+
+		if (copy_from_user((char *) &wmark, optval, sizeof(wmark))) {
+			err = -EFAULT;
+			break;
+		}
+
+		if (!wmark.high || wmark.high > 100 || wmark.low >= wmark.high) {
+			err = -EINVAL;
+			break;
+		}
+
+		rfcomm_sk_ext(sk)->rx_high = wmark.high;
+		rfcomm_sk_ext(sk)->rx_low  = wmark.low;
+
+		if (!rfcomm_sk_ext(sk)->rx_ring)
+			rfcomm_sock_rx_update(sk);
+		break;
+
+	case RFCOMM_RX_RING:
+		if (get_user(opt, (u32 __user *) optval)) {
+			err = -EFAULT;
+			break;
+		}
+
+		/* The ring is a byte stream */
+		if (sk->sk_type == SOCK_SEQPACKET) {
+			err = -EINVAL;
+			break;
+		}
+
+		err = rfcomm_sock_ring_setup(sk, opt);
+		break;
+
 	default:
 		err = -ENOPROTOOPT;
 		break;
@@ -666,7 +1513,7 @@ int RFCOMM_SOCK::rfcomm_sock_setsockopt(struct socket *sock, int level, int optn
 
 	switch (optname) {
 	case BT_SECURITY:
-		if (sk->sk_type != SOCK_STREAM) {
+		if (sk->sk_type != SOCK_STREAM && sk->sk_type != SOCK_SEQPACKET) {
 			err = -EINVAL;
 			break;
 		}
@@ -718,6 +1565,7 @@ int RFCOMM_SOCK::rfcomm_sock_getsockopt_old(struct socket *sock, int optname, ch
 {
 	struct sock *sk = sock->sk;
 	struct rfcomm_conninfo cinfo;
+	struct rfcomm_rx_wmark wmark;
 	struct l2cap_conn *conn = l2cap_pi(sk)->chan->conn;
 	int len, err = 0;
 	u32 opt;
@@ -754,6 +1602,40 @@ int RFCOMM_SOCK::rfcomm_sock_getsockopt_old(struct socket *sock, int optname, ch
 			err = -EFAULT;
 		break;
 
+	case RFCOMM_ACCEPT_POOL:
+		if (put_user(rfcomm_sk_ext(sk)->pool_size, (u32 __user *) optval))
+			err = -EFAULT;
+		break;
+
+	case RFCOMM_COALESCE:
+		if (put_user(rfcomm_sk_ext(sk)->coalesce, (u32 __user *) optval))
+			err = -EFAULT;
+		break;
+
+	case RFCOMM_RCV_DEFER:
+		if (put_user(rfcomm_sk_ext(sk)->rcv_defer, (u32 __user *) optval))
+			err = -EFAULT;
+		break;
+
+	case RFCOMM_BUSY_POLL:
+		if (put_user(rfcomm_sk_ext(sk)->busy_poll, (u32 __user *) optval))
+			err = -EFAULT;
+		break;
+
+	case RFCOMM_RX_WMARK:
+		wmark.high = rfcomm_sk_ext(sk)->rx_high;
+		wmark.low  = rfcomm_sk_ext(sk)->rx_low;
+
+		len = min_t(unsigned int, len, sizeof(wmark));
+		if (copy_to_user(optval, (char *) &wmark, len))
+			err = -EFAULT;
+		break;
+
+	case RFCOMM_RX_RING:
+		if (put_user(rfcomm_sk_ext(sk)->rx_size, (u32 __user *) optval))
+			err = -EFAULT;
+		break;
+
 	case RFCOMM_CONNINFO:
 		if (sk->sk_state != BT_CONNECTED &&
 					!rfcomm_pi(sk)->dlc->defer_setup) {
@@ -801,7 +1683,7 @@ int RFCOMM_SOCK::rfcomm_sock_getsockopt(struct socket *sock, int level, int optn
 
 	switch (optname) {
 	case BT_SECURITY:
-		if (sk->sk_type != SOCK_STREAM) {
+		if (sk->sk_type != SOCK_STREAM && sk->sk_type != SOCK_SEQPACKET) {
 			err = -EINVAL;
 			break;
 		}
@@ -858,6 +1740,49 @@ int RFCOMM_SOCK::rfcomm_sock_ioctl(struct socket *sock, unsigned int cmd, unsign
 	return err;
 }
 
+unsigned int RFCOMM_SOCK::rfcomm_sock_poll(struct file *file, struct socket *sock, poll_table *wait)
+{
+	struct sock *sk = sock->sk;
+	struct rfcomm_sock_ext *ext = rfcomm_sk_ext(sk);
+	unsigned int mask;
+
+	/* Don't leave parked frames to rx_timer if the reader asks */
+	if (ext->rx_ring)
+		rfcomm_sock_ring_fill(sk);
+
+	mask = bt_sock_poll(file, sock, wait);
+
+	if (sk->sk_state == BT_LISTEN)
+		return mask;
+
+	/* Honour SO_RCVLOWAT and the deferred wakeup */
+	mask &= ~(POLLIN | POLLRDNORM);
+	if (rfcomm_sock_readable(sk))
+		mask |= POLLIN | POLLRDNORM;
+
+	return mask;
+}
+
+int RFCOMM_SOCK::rfcomm_sock_mmap(struct file *file, struct socket *sock, struct vm_area_struct *vma)
+{
+	struct sock *sk = sock->sk;
+	int err;
+
+	BT_DBG("sk %p", sk);
+
+	if (vma->vm_pgoff)
+		return -EINVAL;
+
+	lock_sock(sk);
+	if (rfcomm_sk_ext(sk)->rx_ring)
+		err = remap_vmalloc_range(vma, rfcomm_sk_ext(sk)->rx_ring, 0);
+	else
+		err = -EINVAL;
+	release_sock(sk);
+
+	return err;
+}
+
 int RFCOMM_SOCK::rfcomm_sock_shutdown(struct socket *sock, int how)
 {
 	struct sock *sk = sock->sk;
@@ -924,11 +1849,16 @@ int RFCOMM_SOCK::rfcomm_connect_ind(struct rfcomm_session *s, u8 channel, struct
 		goto done;
 	}
 
-	sk = rfcomm_sock_alloc(sock_net(parent), NULL, BTPROTO_RFCOMM, GFP_ATOMIC);
-	if (!sk)
-		goto done;
+	sk = rfcomm_sock_pool_get(parent);
+	if (!sk) {
+		sk = rfcomm_sock_alloc(sock_net(parent), NULL, BTPROTO_RFCOMM, GFP_ATOMIC);
+		if (!sk) {
+			BT_ERR("Can't allocate socket for channel %d", channel);
+			goto done;
+		}
 
-	bt_sock_reclassify_lock(sk, BTPROTO_RFCOMM);
+		bt_sock_reclassify_lock(sk, BTPROTO_RFCOMM);
+	}
 
 	rfcomm_sock_init(sk, parent);
 	bacpy(&bt_sk(sk)->src, &src);
@@ -1012,6 +1942,10 @@ static int rfcomm_sock_sendmsg(struct kiocb *iocb, struct socket *sock,
 					   struct msghdr *msg, size_t len){
 	return rfcomm_sock.rfcomm_sock_sendmsg(iocb, sock, msg, len);					   
 }
+static ssize_t rfcomm_sock_sendpage(struct socket *sock, struct page *page,
+					   int offset, size_t size, int flags){
+	return rfcomm_sock.rfcomm_sock_sendpage(sock, page, offset, size, flags);
+}
 static int rfcomm_sock_recvmsg(struct kiocb *iocb, struct socket *sock,
 					   struct msghdr *msg, size_t size, int flags){
 	return rfcomm_sock.rfcomm_sock_recvmsg(iocb, sock, msg, size, flags);
@@ -1028,6 +1962,12 @@ static int rfcomm_sock_setsockopt(struct socket *sock, int level, int optname, c
 static int rfcomm_sock_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg){
 	return rfcomm_sock.rfcomm_sock_ioctl(sock, cmd, arg);
 }
+static unsigned int rfcomm_sock_poll(struct file *file, struct socket *sock, poll_table *wait){
+	return rfcomm_sock.rfcomm_sock_poll(file, sock, wait);
+}
+static int rfcomm_sock_mmap(struct file *file, struct socket *sock, struct vm_area_struct *vma){
+	return rfcomm_sock.rfcomm_sock_mmap(file, sock, vma);
+}
 
 
 void rfcomm_sk_data_ready(struct rfcomm_dlc *d, struct sk_buff *skb){
@@ -1039,6 +1979,18 @@ void rfcomm_sk_state_change(struct rfcomm_dlc *d, int err){
 void rfcomm_sock_destruct(struct sock *sk){
 	rfcomm_sock.rfcomm_sock_destruct_cls(sk);
 }
+void rfcomm_sock_pool_work(struct work_struct *work){
+	rfcomm_sock.rfcomm_sock_pool_work_cls(work);
+}
+void rfcomm_sock_flush_timeout(unsigned long arg){
+	rfcomm_sock.rfcomm_sock_flush_timeout_cls(arg);
+}
+void rfcomm_sock_rcv_timeout(unsigned long arg){
+	rfcomm_sock.rfcomm_sock_rcv_timeout_cls(arg);
+}
+void rfcomm_sock_ring_timeout(unsigned long arg){
+	rfcomm_sock.rfcomm_sock_ring_timeout_cls(arg);
+}
 int rfcomm_sock_debugfs_show(struct seq_file *f, void *p){
 	return rfcomm_sock.rfcomm_sock_debugfs_show_cls(f, p);
 }
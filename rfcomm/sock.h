@@ -28,13 +28,120 @@
 #include <c++/begin_include.h>
 #include <linux/export.h>
 #include <linux/debugfs.h>
+#include <linux/vmalloc.h>
+#include <linux/errqueue.h>
 
 #include <net/bluetooth/bluetooth.h>
 #include <net/bluetooth/hci_core.h>
 #include <net/bluetooth/l2cap.h>
 #include <net/bluetooth/rfcomm.h>
+
+#include "rfcomm_ext.h"
 #include <c++/end_include.h>
 
+#define RFCOMM_MAX_CHANNEL	30
+
+/* SOL_RFCOMM socket options */
+#define RFCOMM_ACCEPT_POOL	0x10
+#define RFCOMM_COALESCE		0x11
+#define RFCOMM_FLUSH		0x12
+#define RFCOMM_RX_RING		0x13
+
+/* SOL_RFCOMM cmsg carrying the sock_extended_err of a TX timestamp */
+#define RFCOMM_TX_TIMESTAMP	0x14
+
+#define RFCOMM_RCV_DEFER	0x15
+#define RFCOMM_RX_WMARK		0x16
+#define RFCOMM_BUSY_POLL	0x17
+
+/* RX backpressure in percent of sk_rcvbuf: the DLC is throttled once
+ * high is queued and unthrottled again at low. */
+struct rfcomm_rx_wmark {
+	__u32	high;
+	__u32	low;
+};
+
+#define RFCOMM_RX_WMARK_HIGH	100
+#define RFCOMM_RX_WMARK_LOW	25
+
+#define RFCOMM_ACCEPT_POOL_MAX	64
+
+/* Upper bound of the write coalescing delay in ms */
+#define RFCOMM_COALESCE_MAX	1000
+
+/* Upper bound of the deferred reader wakeup in ms */
+#define RFCOMM_RCV_DEFER_MAX	1000
+
+/* Upper bound of the receive busy poll in us */
+#define RFCOMM_BUSY_POLL_MAX	10000
+
+/* Memory mapped RX ring. The mapping starts with struct rfcomm_rx_ring,
+ * the data area follows at RFCOMM_RX_RING_DATA. head and tail are free
+ * running byte counters: the kernel only advances head, userspace only
+ * advances tail once it has consumed the data.
+ */
+struct rfcomm_rx_ring {
+	__u32	size;
+	__u32	head;
+	__u32	tail;
+};
+
+#define RFCOMM_RX_RING_DATA	64
+#define RFCOMM_RX_RING_MIN	PAGE_SIZE
+#define RFCOMM_RX_RING_MAX	(4 << 20)
+
+/* Retry interval for frames parked while the ring is full */
+#define RFCOMM_RX_RING_RETRY	msecs_to_jiffies(10)
+
+/* Private socket data, rfcomm_pinfo must stay first */
+struct rfcomm_sock_ext {
+	struct rfcomm_pinfo	pi;
+
+	/* Listening sockets keep a pool of ready child sockets so that
+	 * rfcomm_connect_ind() does not have to allocate. */
+	spinlock_t		pool_lock;
+	struct list_head	pool;
+	unsigned int		pool_len;
+	unsigned int		pool_size;
+	struct work_struct	pool_work;
+
+	/* Entry of a pooled child on its parent's pool */
+	struct list_head	pool_node;
+
+	/* Write coalescing: small writes are merged into tx_skb until it
+	 * reaches the DLC MTU or tx_timer fires after coalesce ms. */
+	unsigned int		coalesce;
+	spinlock_t		tx_lock;
+	struct sk_buff		*tx_skb;
+	struct timer_list	tx_timer;
+
+	/* RX ring shared with userspace, rx_size and rx_head are the
+	 * kernel's own copies and are never read back from the mapping. */
+	spinlock_t		rx_lock;
+	struct rfcomm_rx_ring	*rx_ring;
+	u32			rx_size;
+	u32			rx_head;
+
+	/* Armed while frames are parked, a reader that only moves tail
+	 * makes no syscall that could move them into the ring. */
+	struct timer_list	rx_timer;
+
+	/* Readers are woken once sk_rcvlowat bytes are queued. With
+	 * rcv_defer set, a smaller amount wakes them after rcv_defer ms. */
+	unsigned int		rcv_defer;
+	bool			rcv_expired;
+	struct timer_list	rcv_timer;
+
+	/* RX watermarks, see struct rfcomm_rx_wmark */
+	u8			rx_high;
+	u8			rx_low;
+
+	/* Receive busy poll in us, like SO_BUSY_POLL */
+	unsigned int		busy_poll;
+};
+
+#define rfcomm_sk_ext(sk) ((struct rfcomm_sock_ext *) sk)
+
 class RFCOMM_SOCK{
 private:
 	/* ---- DLC callbacks ----
@@ -45,6 +152,15 @@ private:
 //	void rfcomm_sk_state_change(struct rfcomm_dlc *d, int err);
 
 	/* ---- Socket functions ---- */
+
+	/* Channel index of bound and listening sockets.
+	 * Must be called under rfcomm_chan_lock.
+	 */
+	void __rfcomm_sock_hash(struct sock *sk);
+
+	/* Takes rfcomm_chan_lock itself */
+	void rfcomm_sock_unhash(struct sock *sk);
+
 	struct sock *__rfcomm_get_sock_by_addr(u8 channel, bdaddr_t *src);
 
 	/* Find socket with channel and source bdaddr.
@@ -54,6 +170,34 @@ private:
 //	void rfcomm_sock_destruct(struct sock *sk);
 	void rfcomm_sock_cleanup_listen(struct sock *parent);
 
+	/* ---- Accept pool ---- */
+	void rfcomm_sock_pool_refill(struct sock *parent);
+	struct sock *rfcomm_sock_pool_get(struct sock *parent);
+	void rfcomm_sock_pool_trim(struct sock *parent, unsigned int size);
+	void rfcomm_sock_pool_purge(struct sock *parent);
+
+	/* ---- Write coalescing ---- */
+	void rfcomm_sock_flush(struct sock *sk);
+	int rfcomm_sock_sendmsg_coalesce(struct sock *sk, struct msghdr *msg, size_t len);
+
+	int rfcomm_sock_recv_errqueue(struct sock *sk, struct msghdr *msg, size_t size);
+	int rfcomm_sock_recv_record(struct sock *sk, struct msghdr *msg, size_t size, int flags);
+
+	/* ---- RX backpressure ---- */
+	void rfcomm_sock_rx_update(struct sock *sk);
+
+	void rfcomm_sock_busy_poll(struct sock *sk, int nonblock);
+
+	/* ---- Reader wakeup ---- */
+	bool rfcomm_sock_readable(struct sock *sk);
+	void rfcomm_sock_data_wakeup(struct sock *sk, int len);
+
+	/* ---- RX ring ---- */
+	int rfcomm_sock_ring_put(struct sock *sk, struct sk_buff *skb);
+	void rfcomm_sock_ring_rcv(struct sock *sk, struct sk_buff *skb);
+	void rfcomm_sock_ring_fill(struct sock *sk);
+	int rfcomm_sock_ring_setup(struct sock *sk, u32 size);
+
 	/* Kill socket (only if zapped and orphan)
 	 * Must be called on unlocked socket.
 	 */
@@ -85,17 +229,25 @@ public:
 	int rfcomm_sock_getname(struct socket *sock, struct sockaddr *addr, int *len, int peer);
 	int rfcomm_sock_sendmsg(struct kiocb *iocb, struct socket *sock,
 					   struct msghdr *msg, size_t len);
+	ssize_t rfcomm_sock_sendpage(struct socket *sock, struct page *page,
+					   int offset, size_t size, int flags);
 	int rfcomm_sock_recvmsg(struct kiocb *iocb, struct socket *sock,
 					   struct msghdr *msg, size_t size, int flags);
 	int rfcomm_sock_shutdown(struct socket *sock, int how);
 	int rfcomm_sock_getsockopt(struct socket *sock, int level, int optname, char __user *optval, int __user *optlen);
 	int rfcomm_sock_setsockopt(struct socket *sock, int level, int optname, char __user *optval, unsigned int optlen);
 	int rfcomm_sock_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg);
+	unsigned int rfcomm_sock_poll(struct file *file, struct socket *sock, poll_table *wait);
+	int rfcomm_sock_mmap(struct file *file, struct socket *sock, struct vm_area_struct *vma);
 
 
         void rfcomm_sk_data_ready_cls(struct rfcomm_dlc *d, struct sk_buff *skb);
         void rfcomm_sk_state_change_cls(struct rfcomm_dlc *d, int err);
 	void rfcomm_sock_destruct_cls(struct sock *sk);
+	void rfcomm_sock_pool_work_cls(struct work_struct *work);
+	void rfcomm_sock_flush_timeout_cls(unsigned long arg);
+	void rfcomm_sock_rcv_timeout_cls(unsigned long arg);
+	void rfcomm_sock_ring_timeout_cls(unsigned long arg);
 	int rfcomm_sock_debugfs_show_cls(struct seq_file *f, void *p);
 }rfcomm_sock;
 
@@ -119,23 +271,31 @@ static int rfcomm_sock_accept(struct socket *sock, struct socket *newsock, int f
 static int rfcomm_sock_getname(struct socket *sock, struct sockaddr *addr, int *len, int peer);
 	static int rfcomm_sock_sendmsg(struct kiocb *iocb, struct socket *sock,
 					   struct msghdr *msg, size_t len);
+static ssize_t rfcomm_sock_sendpage(struct socket *sock, struct page *page,
+					   int offset, size_t size, int flags);
 static int rfcomm_sock_recvmsg(struct kiocb *iocb, struct socket *sock,
 					   struct msghdr *msg, size_t size, int flags);
 static int rfcomm_sock_shutdown(struct socket *sock, int how);
 static int rfcomm_sock_getsockopt(struct socket *sock, int level, int optname, char __user *optval, int __user *optlen);
 static int rfcomm_sock_setsockopt(struct socket *sock, int level, int optname, char __user *optval, unsigned int optlen);
 static int rfcomm_sock_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg);
+static unsigned int rfcomm_sock_poll(struct file *file, struct socket *sock, poll_table *wait);
+static int rfcomm_sock_mmap(struct file *file, struct socket *sock, struct vm_area_struct *vma);
 
 
 void rfcomm_sk_data_ready(struct rfcomm_dlc *d, struct sk_buff *skb);
 void rfcomm_sk_state_change(struct rfcomm_dlc *d, int err);
 void rfcomm_sock_destruct(struct sock *sk);
+void rfcomm_sock_pool_work(struct work_struct *work);
+void rfcomm_sock_flush_timeout(unsigned long arg);
+void rfcomm_sock_rcv_timeout(unsigned long arg);
+void rfcomm_sock_ring_timeout(unsigned long arg);
 int rfcomm_sock_debugfs_show(struct seq_file *f, void *p);
 
 static struct proto rfcomm_proto = {
 	.name		= "RFCOMM",
 	.owner		= THIS_MODULE,
-	.obj_size	= sizeof(struct rfcomm_pinfo)
+	.obj_size	= sizeof(struct rfcomm_sock_ext)
 };
 
 static const struct file_operations rfcomm_sock_debugfs_fops = {
@@ -155,14 +315,15 @@ static const struct proto_ops rfcomm_sock_ops = {
 	.accept		= rfcomm_sock_accept,
 	.getname	= rfcomm_sock_getname,
 	.sendmsg	= rfcomm_sock_sendmsg,
+	.sendpage	= rfcomm_sock_sendpage,
 	.recvmsg	= rfcomm_sock_recvmsg,
 	.shutdown	= rfcomm_sock_shutdown,
 	.setsockopt	= rfcomm_sock_setsockopt,
 	.getsockopt	= rfcomm_sock_getsockopt,
 	.ioctl		= rfcomm_sock_ioctl,
-	.poll		= bt_sock_poll,
+	.poll		= rfcomm_sock_poll,
 	.socketpair	= sock_no_socketpair,
-	.mmap		= sock_no_mmap
+	.mmap		= rfcomm_sock_mmap
 };
 
 static const struct net_proto_family rfcomm_sock_family_ops = {
@@ -27,6 +27,11 @@
 
 #include "tty.h"
 
+/* How long a partially filled frame is held back for more writes */
+static unsigned int tty_coalesce_usecs = 1000;
+module_param(tty_coalesce_usecs, uint, 0644);
+MODULE_PARM_DESC(tty_coalesce_usecs, "Max delay of coalesced RFCOMM TTY writes");
+
 void RFCOMM_TTY::rfcomm_dev_destruct(struct tty_port *port)
 {
 	struct rfcomm_dev *dev = container_of(port, struct rfcomm_dev, port);
@@ -35,9 +40,14 @@ void RFCOMM_TTY::rfcomm_dev_destruct(struct tty_port *port)
 	BT_DBG("dev %p dlc %p", dev, dlc);
 
 	/* Refcount should only hit zero when called from rfcomm_dev_del()
-	   which will have taken us off the list. Everything else are
+	   which will have taken us out of the idr. Everything else are
 	   refcounting bugs. */
-	BUG_ON(!list_empty(&dev->list));
+	rcu_read_lock();
+	BUG_ON(idr_find(&rfcomm_dev_idr, dev->id) == dev);
+	rcu_read_unlock();
+
+	cancel_delayed_work_sync(&dev->pending_work);
+	del_timer_sync(&dev->tx_timer);
 
 	rfcomm_dlc_lock(dlc);
 	/* Detach DLC if it's owned by this dev */
@@ -49,40 +59,39 @@ void RFCOMM_TTY::rfcomm_dev_destruct(struct tty_port *port)
 
 	tty_unregister_device(rfcomm_tty_driver, dev->id);
 
-	kfree(dev);
+	skb_queue_purge(&dev->tx_pool);
+	skb_queue_purge(&dev->pending);
+
+	/* Lockless rfcomm_dev_get() may still be looking at it */
+	kfree_rcu(dev, rcu);
 
 	/* It's safe to call module_put() here because socket still
 	   holds reference to this module. */
 	module_put(THIS_MODULE);
 }
 
+/* Must be called under rcu_read_lock() or rfcomm_dev_lock */
 struct rfcomm_dev* RFCOMM_TTY::__rfcomm_dev_get(int id)
 {
-	struct rfcomm_dev *dev;
-
-	list_for_each_entry(dev, &rfcomm_dev_list, list)
-		if (dev->id == id)
-			return dev;
-
-	return NULL;
+	return (struct rfcomm_dev *) idr_find(&rfcomm_dev_idr, id);
 }
 
 struct rfcomm_dev* RFCOMM_TTY::rfcomm_dev_get(int id)
 {
 	struct rfcomm_dev *dev;
 
-	spin_lock(&rfcomm_dev_lock);
+	rcu_read_lock();
 
 	dev = __rfcomm_dev_get(id);
 
+	/* The last reference may be going away concurrently */
 	if (dev) {
-		if (test_bit(RFCOMM_TTY_RELEASED, &dev->flags))
+		if (test_bit(RFCOMM_TTY_RELEASED, &dev->flags) ||
+				!kref_get_unless_zero(&dev->port.kref))
 			dev = NULL;
-		else
-			tty_port_get(&dev->port);
 	}
 
-	spin_unlock(&rfcomm_dev_lock);
+	rcu_read_unlock();
 
 	return dev;
 }
@@ -117,65 +126,64 @@ ssize_t RFCOMM_TTY::show_channel(struct device *tty_dev, struct device_attribute
 
 int RFCOMM_TTY::rfcomm_dev_add(struct rfcomm_dev_req *req, struct rfcomm_dlc *dlc)
 {
-	struct rfcomm_dev *dev, *entry;
-	struct list_head *head = &rfcomm_dev_list;
-	int err = 0;
+	struct rfcomm_dev *dev;
+	int start, end, err = 0;
 
 	BT_DBG("id %d channel %d", req->dev_id, req->channel);
 
-	dev = kzalloc(sizeof(struct rfcomm_dev), GFP_KERNEL);
-	if (!dev)
-		return -ENOMEM;
-
-	spin_lock(&rfcomm_dev_lock);
-
 	if (req->dev_id < 0) {
-		dev->id = 0;
-
-		list_for_each_entry(entry, &rfcomm_dev_list, list) {
-			if (entry->id != dev->id)
-				break;
-
-			dev->id++;
-			head = &entry->list;
-		}
+		start = 0;
+		end   = RFCOMM_TTY_PORTS;
 	} else {
-		dev->id = req->dev_id;
-
-		list_for_each_entry(entry, &rfcomm_dev_list, list) {
-			if (entry->id == dev->id) {
-				err = -EADDRINUSE;
-				goto out;
-			}
-
-			if (entry->id > dev->id - 1)
-				break;
-
-			head = &entry->list;
-		}
-	}
+		if (req->dev_id >= RFCOMM_TTY_PORTS)
+			return -ENFILE;
 
-	if ((dev->id < 0) || (dev->id > RFCOMM_MAX_DEV - 1)) {
-		err = -ENFILE;
-		goto out;
+		start = req->dev_id;
+		end   = req->dev_id + 1;
 	}
 
-	sprintf(dev->name, "rfcomm%d", dev->id);
+	dev = kzalloc(sizeof(struct rfcomm_dev), GFP_KERNEL);
+	if (!dev)
+		return -ENOMEM;
 
-	list_add(&dev->list, head);
+	/* Everything a lockless lookup may touch is set up before the
+	 * device goes into the idr */
+	dev->dlc = dlc;
 
 	bacpy(&dev->src, &req->src);
 	bacpy(&dev->dst, &req->dst);
 	dev->channel = req->channel;
 
 	dev->flags = req->flags &
-		((1 << RFCOMM_RELEASE_ONHUP) | (1 << RFCOMM_REUSE_DLC));
+		((1 << RFCOMM_RELEASE_ONHUP) | (1 << RFCOMM_REUSE_DLC) |
+		 RFCOMM_TTY_USER_FLAGS);
 
 	tty_port_init(&dev->port);
 	dev->port.ops = &rfcomm_port_ops;
+	dev->port.low_latency = test_bit(RFCOMM_LOW_LATENCY, &dev->flags);
 	init_waitqueue_head(&dev->wait);
 
 	skb_queue_head_init(&dev->pending);
+	INIT_DELAYED_WORK(&dev->pending_work, rfcomm_tty_pending_work);
+	skb_queue_head_init(&dev->tx_pool);
+	spin_lock_init(&dev->tx_lock);
+	setup_timer(&dev->tx_timer, rfcomm_dev_tx_timeout, (unsigned long) dev);
+
+	idr_preload(GFP_KERNEL);
+	spin_lock(&rfcomm_dev_lock);
+
+	/* Lowest free id, as before */
+	err = idr_alloc(&rfcomm_dev_idr, dev, start, end, GFP_NOWAIT);
+	if (err < 0) {
+		if (err == -ENOSPC)
+			err = req->dev_id < 0 ? -ENFILE : -EADDRINUSE;
+		goto out;
+	}
+
+	dev->id = err;
+	err = 0;
+
+	sprintf(dev->name, "rfcomm%d", dev->id);
 
 	rfcomm_dlc_lock(dlc);
 
@@ -197,6 +205,8 @@ int RFCOMM_TTY::rfcomm_dev_add(struct rfcomm_dev_req *req, struct rfcomm_dlc *dl
 	dlc->data_ready   = rfcomm_dev_data_ready;
 	dlc->state_change = rfcomm_dev_state_change;
 	dlc->modem_status = rfcomm_dev_modem_status;
+	rfcomm_dlc_ext(dlc)->tx_done = rfcomm_dev_tx_done;
+	rfcomm_dlc_ext(dlc)->rx_flush = rfcomm_dev_rx_flush;
 
 	dlc->owner = dev;
 	dev->dlc   = dlc;
@@ -211,6 +221,7 @@ int RFCOMM_TTY::rfcomm_dev_add(struct rfcomm_dev_req *req, struct rfcomm_dlc *dl
 
 out:
 	spin_unlock(&rfcomm_dev_lock);
+	idr_preload_end();
 
 	if (err < 0)
 		goto free;
@@ -219,7 +230,8 @@ out:
 			dev->id, NULL);
 	if (IS_ERR(dev->tty_dev)) {
 		err = PTR_ERR(dev->tty_dev);
-		list_del(&dev->list);
+		rfcomm_dev_unlink(dev);
+		synchronize_rcu();
 		goto free;
 	}
 
@@ -252,13 +264,20 @@ void RFCOMM_TTY::rfcomm_dev_del(struct rfcomm_dev *dev)
 	}
 	spin_unlock_irqrestore(&dev->port.lock, flags);
 
-	spin_lock(&rfcomm_dev_lock);
-	list_del_init(&dev->list);
-	spin_unlock(&rfcomm_dev_lock);
+	rfcomm_dev_unlink(dev);
 
 	tty_port_put(&dev->port);
 }
 
+/* Take the device out of the idr, unless that already happened */
+void RFCOMM_TTY::rfcomm_dev_unlink(struct rfcomm_dev *dev)
+{
+	spin_lock(&rfcomm_dev_lock);
+	if (__rfcomm_dev_get(dev->id) == dev)
+		idr_remove(&rfcomm_dev_idr, dev->id);
+	spin_unlock(&rfcomm_dev_lock);
+}
+
 /* ---- Send buffer ---- */
 inline unsigned int RFCOMM_TTY::rfcomm_room(struct rfcomm_dlc *dlc)
 {
@@ -271,12 +290,21 @@ void RFCOMM_TTY::rfcomm_wfree(struct sk_buff *skb)
 {
 	struct rfcomm_dev *dev = (struct rfcomm_dev *) skb->sk;
 	struct tty_struct *tty = dev->port.tty;
+	rfcomm_dev_tx_sent(dev, skb);
 	atomic_sub(skb->truesize, &dev->wmem_alloc);
 	if (test_bit(RFCOMM_TTY_ATTACHED, &dev->flags) && tty)
 		tty_wakeup(tty);
 	tty_port_put(&dev->port);
 }
 
+/* Payload of the skb is no longer queued, either it was handed to
+ * L2CAP or it was dropped. */
+void RFCOMM_TTY::rfcomm_dev_tx_sent(struct rfcomm_dev *dev, struct sk_buff *skb)
+{
+	if (atomic_sub_and_test(rfcomm_skb_cb(skb)->len, &dev->tx_bytes))
+		wake_up_interruptible(&dev->wait);
+}
+
 void RFCOMM_TTY::rfcomm_set_owner_w(struct sk_buff *skb, struct rfcomm_dev *dev)
 {
 	tty_port_get(&dev->port);
@@ -288,7 +316,16 @@ void RFCOMM_TTY::rfcomm_set_owner_w(struct sk_buff *skb, struct rfcomm_dev *dev)
 struct sk_buff* RFCOMM_TTY::rfcomm_wmalloc(struct rfcomm_dev *dev, unsigned long size, gfp_t priority)
 {
 	if (atomic_read(&dev->wmem_alloc) < rfcomm_room(dev->dlc)) {
-		struct sk_buff *skb = alloc_skb(size, priority);
+		struct sk_buff *skb = skb_dequeue(&dev->tx_pool);
+
+		/* MTU changed since the skb was pooled */
+		if (skb && skb_tailroom(skb) < size) {
+			kfree_skb(skb);
+			skb = NULL;
+		}
+
+		if (!skb)
+			skb = alloc_skb(size, priority);
 		if (skb) {
 			rfcomm_set_owner_w(skb, dev);
 			return skb;
@@ -297,6 +334,55 @@ struct sk_buff* RFCOMM_TTY::rfcomm_wmalloc(struct rfcomm_dev *dev, unsigned long
 	return NULL;
 }
 
+/* Send the frame held back for coalescing now */
+void RFCOMM_TTY::rfcomm_dev_tx_flush(struct rfcomm_dev *dev)
+{
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->tx_lock, flags);
+	skb = dev->tx_tail;
+	dev->tx_tail = NULL;
+	del_timer(&dev->tx_timer);
+	if (skb && rfcomm_dlc_send(dev->dlc, skb) >= 0)
+		skb = NULL;
+	spin_unlock_irqrestore(&dev->tx_lock, flags);
+
+	/* Not sent, the DLC is gone. Freed outside tx_lock since this
+	 * may put the last port reference. */
+	kfree_skb(skb);
+}
+
+/* Holds no port reference. Stopped whenever tx_tail is emptied and
+ * synchronously on close and in rfcomm_dev_destruct(). */
+void RFCOMM_TTY::rfcomm_dev_tx_timeout(unsigned long arg)
+{
+	struct rfcomm_dev *dev = (struct rfcomm_dev *) arg;
+
+	BT_DBG("dev %p", dev);
+
+	rfcomm_dev_tx_flush(dev);
+}
+
+/* Pool one credit window of MTU sized skbs, the write path then
+ * doesn't allocate once the DLC is up. */
+void RFCOMM_TTY::rfcomm_dev_pool_fill(struct rfcomm_dev *dev)
+{
+	struct rfcomm_dlc *dlc = dev->dlc;
+	struct sk_buff *skb;
+
+	dev->tx_pool_size = dlc->cfc ? dlc->cfc : RFCOMM_DEFAULT_CREDITS;
+
+	while (skb_queue_len(&dev->tx_pool) < dev->tx_pool_size) {
+		skb = alloc_skb(dlc->mtu + RFCOMM_SKB_RESERVE, GFP_KERNEL);
+		if (!skb)
+			break;
+		skb_queue_tail(&dev->tx_pool, skb);
+	}
+
+	BT_DBG("dev %p pool %d", dev, skb_queue_len(&dev->tx_pool));
+}
+
 int RFCOMM_TTY::rfcomm_create_dev(struct sock *sk, void __user *arg)
 {
 	struct rfcomm_dev_req req;
@@ -308,7 +394,8 @@ int RFCOMM_TTY::rfcomm_create_dev(struct sock *sk, void __user *arg)
 
 	BT_DBG("sk %p dev_id %d flags 0x%x", sk, req.dev_id, req.flags);
 
-	if (req.flags != NOCAP_FLAGS && !capable(CAP_NET_ADMIN))
+	if ((req.flags & ~RFCOMM_TTY_USER_FLAGS) != NOCAP_FLAGS &&
+			!capable(CAP_NET_ADMIN))
 		return -EPERM;
 
 	if (req.flags & (1 << RFCOMM_REUSE_DLC)) {
@@ -353,7 +440,8 @@ int RFCOMM_TTY::rfcomm_release_dev(void __user *arg)
 	if (!dev)
 		return -ENODEV;
 
-	if (dev->flags != NOCAP_FLAGS && !capable(CAP_NET_ADMIN)) {
+	if ((dev->flags & ~RFCOMM_TTY_USER_FLAGS) != NOCAP_FLAGS &&
+			!capable(CAP_NET_ADMIN)) {
 		tty_port_put(&dev->port);
 		return -EPERM;
 	}
@@ -376,7 +464,7 @@ int RFCOMM_TTY::rfcomm_get_dev_list(void __user *arg)
 	struct rfcomm_dev *dev;
 	struct rfcomm_dev_list_req *dl;
 	struct rfcomm_dev_info *di;
-	int n = 0, size, err;
+	int n = 0, id, size, err;
 	u16 dev_num;
 
 	BT_DBG("");
@@ -395,9 +483,9 @@ int RFCOMM_TTY::rfcomm_get_dev_list(void __user *arg)
 
 	di = dl->dev_info;
 
-	spin_lock(&rfcomm_dev_lock);
+	rcu_read_lock();
 
-	list_for_each_entry(dev, &rfcomm_dev_list, list) {
+	idr_for_each_entry(&rfcomm_dev_idr, dev, id) {
 		if (test_bit(RFCOMM_TTY_RELEASED, &dev->flags))
 			continue;
 		(di + n)->id      = dev->id;
@@ -410,7 +498,7 @@ int RFCOMM_TTY::rfcomm_get_dev_list(void __user *arg)
 			break;
 	}
 
-	spin_unlock(&rfcomm_dev_lock);
+	rcu_read_unlock();
 
 	dl->dev_num = n;
 	size = sizeof(*dl) + n * sizeof(*di);
@@ -449,6 +537,19 @@ int RFCOMM_TTY::rfcomm_get_dev_info(void __user *arg)
 	return err;
 }
 
+void RFCOMM_TTY::rfcomm_dev_set_low_latency(struct rfcomm_dev *dev, bool on)
+{
+	BT_DBG("dev %p low latency %d", dev, on);
+
+	rfcomm_dlc_lock(dev->dlc);
+	if (on)
+		set_bit(RFCOMM_LOW_LATENCY, &dev->flags);
+	else
+		clear_bit(RFCOMM_LOW_LATENCY, &dev->flags);
+	dev->port.low_latency = on;
+	rfcomm_dlc_unlock(dev->dlc);
+}
+
 int RFCOMM_TTY::rfcomm_dev_ioctl(struct sock *sk, unsigned int cmd, void __user *arg)
 {
 	BT_DBG("cmd %d arg %p", cmd, arg);
@@ -487,12 +588,40 @@ void RFCOMM_TTY::rfcomm_dev_data_ready(struct rfcomm_dlc *dlc, struct sk_buff *s
 
 	BT_DBG("dlc %p len %d", dlc, skb->len);
 
-	tty_insert_flip_string(&dev->port, skb->data, skb->len);
-	tty_flip_buffer_push(&dev->port);
+	/* Pushed once per pass by rfcomm_dev_rx_flush() */
+	rfcomm_tty_fill_flip(dev, skb);
+
+	if (skb->len) {
+		BT_DBG("dlc %p flip buffer full, %d bytes pending", dlc, skb->len);
+		skb_queue_tail(&dev->pending, skb);
+		rfcomm_dlc_throttle(dlc);
+		rfcomm_tty_pending_retry(dev);
+		return;
+	}
 
 	kfree_skb(skb);
 }
 
+/* Called by krfcommd without the DLC lock. With low_latency the push
+ * runs the ldisc right here, the port reference keeps dev around. */
+void RFCOMM_TTY::rfcomm_dev_rx_flush(struct rfcomm_dlc *dlc)
+{
+	struct rfcomm_dev *dev;
+
+	rfcomm_dlc_lock(dlc);
+	dev = dlc->owner;
+	if (dev)
+		tty_port_get(&dev->port);
+	rfcomm_dlc_unlock(dlc);
+
+	if (!dev)
+		return;
+
+	tty_flip_buffer_push(&dev->port);
+
+	tty_port_put(&dev->port);
+}
+
 void RFCOMM_TTY::rfcomm_dev_state_change(struct rfcomm_dlc *dlc, int err)
 {
 	struct rfcomm_dev *dev = dlc->owner;
@@ -503,6 +632,7 @@ void RFCOMM_TTY::rfcomm_dev_state_change(struct rfcomm_dlc *dlc, int err)
 
 	dev->err = err;
 	wake_up_interruptible(&dev->wait);
+	wake_up_interruptible(&dev->port.delta_msr_wait);
 
 	if (dlc->state == BT_CLOSED) {
 		if (!dev->port.tty) {
@@ -532,6 +662,8 @@ void RFCOMM_TTY::rfcomm_dev_state_change(struct rfcomm_dlc *dlc, int err)
 void RFCOMM_TTY::rfcomm_dev_modem_status(struct rfcomm_dlc *dlc, u8 v24_sig)
 {
 	struct rfcomm_dev *dev = dlc->owner;
+	uint status, changed;
+
 	if (!dev)
 		return;
 
@@ -542,33 +674,170 @@ void RFCOMM_TTY::rfcomm_dev_modem_status(struct rfcomm_dlc *dlc, u8 v24_sig)
 			tty_hangup(dev->port.tty);
 	}
 
-	dev->modem_status =
+	status =
 		((v24_sig & RFCOMM_V24_RTC) ? (TIOCM_DSR | TIOCM_DTR) : 0) |
 		((v24_sig & RFCOMM_V24_RTR) ? (TIOCM_RTS | TIOCM_CTS) : 0) |
 		((v24_sig & RFCOMM_V24_IC)  ? TIOCM_RI : 0) |
 		((v24_sig & RFCOMM_V24_DV)  ? TIOCM_CD : 0);
+
+	changed = status ^ dev->modem_status;
+	dev->modem_status = status;
+
+	if (!(changed & (TIOCM_CTS | TIOCM_DSR | TIOCM_RI | TIOCM_CD)))
+		return;
+
+	if (changed & TIOCM_CTS)
+		dev->icount.cts++;
+	if (changed & TIOCM_DSR)
+		dev->icount.dsr++;
+	if (changed & TIOCM_RI)
+		dev->icount.rng++;
+	if (changed & TIOCM_CD)
+		dev->icount.dcd++;
+
+	wake_up_interruptible(&dev->port.delta_msr_wait);
+}
+
+/* Called by krfcommd for every sent frame, not under the DLC lock.
+ * The skb holds a port reference, so dev is valid until it is put. */
+void RFCOMM_TTY::rfcomm_dev_tx_done(struct rfcomm_dlc *dlc, struct sk_buff *skb)
+{
+	struct rfcomm_dev *dev = (struct rfcomm_dev *) skb->sk;
+	struct tty_struct *tty;
+
+	/* Frames queued by a socket before the DLC was reused */
+	if (skb->destructor != rfcomm_wfree) {
+		kfree_skb(skb);
+		return;
+	}
+
+	skb->destructor = NULL;
+	skb->sk = NULL;
+	rfcomm_dev_tx_sent(dev, skb);
+	atomic_sub(skb->truesize, &dev->wmem_alloc);
+
+	if (!skb_shared(skb) && !skb_cloned(skb) &&
+			skb_queue_len(&dev->tx_pool) < dev->tx_pool_size) {
+		skb->data = skb->head;
+		skb_reset_tail_pointer(skb);
+		skb->len = 0;
+		memset(skb->cb, 0, sizeof(skb->cb));
+		skb_queue_tail(&dev->tx_pool, skb);
+	} else
+		kfree_skb(skb);
+
+	/* Wake the writer once per half window or when idle,
+	 * not for every frame */
+	if (++dev->tx_done >= (dev->tx_pool_size >> 1) ||
+			skb_queue_empty(&dlc->tx_queue)) {
+		dev->tx_done = 0;
+
+		tty = dev->port.tty;
+		if (test_bit(RFCOMM_TTY_ATTACHED, &dev->flags) && tty)
+			tty_wakeup(tty);
+	}
+
+	tty_port_put(&dev->port);
 }
 
 /* ---- TTY functions ---- */
-void RFCOMM_TTY::rfcomm_tty_copy_pending(struct rfcomm_dev *dev)
+
+/* Copy as much of the skb as fits straight into the flip buffer,
+ * whatever didn't fit is left in the skb. Called under the DLC lock,
+ * which also covers icount. */
+int RFCOMM_TTY::rfcomm_tty_fill_flip(struct rfcomm_dev *dev, struct sk_buff *skb)
+{
+	unsigned char *buf;
+	int space, inserted = 0;
+
+	while (skb->len) {
+		space = tty_prepare_flip_string(&dev->port, &buf, skb->len);
+		if (!space)
+			break;
+
+		memcpy(buf, skb->data, space);
+		skb_pull(skb, space);
+		inserted += space;
+	}
+
+	dev->icount.rx += inserted;
+
+	return inserted;
+}
+
+/* Returns true once nothing is pending anymore */
+bool RFCOMM_TTY::rfcomm_tty_copy_pending(struct rfcomm_dev *dev)
 {
 	struct sk_buff *skb;
 	int inserted = 0;
+	bool empty;
 
 	BT_DBG("dev %p", dev);
 
 	rfcomm_dlc_lock(dev->dlc);
 
 	while ((skb = skb_dequeue(&dev->pending))) {
-		inserted += tty_insert_flip_string(&dev->port, skb->data,
-				skb->len);
+		inserted += rfcomm_tty_fill_flip(dev, skb);
+		if (skb->len) {
+			skb_queue_head(&dev->pending, skb);
+			break;
+		}
 		kfree_skb(skb);
 	}
 
+	empty = skb_queue_empty(&dev->pending);
+
 	rfcomm_dlc_unlock(dev->dlc);
 
 	if (inserted > 0)
 		tty_flip_buffer_push(&dev->port);
+
+	if (!empty)
+		rfcomm_tty_pending_retry(dev);
+
+	return empty;
+}
+
+/* Only poll for flip buffer space while someone reads it, a closed or
+ * throttled tty gets pending_work kicked by open() or unthrottle() */
+void RFCOMM_TTY::rfcomm_tty_pending_retry(struct rfcomm_dev *dev)
+{
+	struct tty_struct *tty;
+
+	tty = tty_port_tty_get(&dev->port);
+	if (!tty)
+		return;
+
+	if (!test_bit(TTY_THROTTLED, &tty->flags))
+		schedule_delayed_work(&dev->pending_work, RFCOMM_TTY_PENDING_RETRY);
+
+	tty_kref_put(tty);
+}
+
+void RFCOMM_TTY::rfcomm_tty_pending_work(struct work_struct *work)
+{
+	struct rfcomm_dev *dev = container_of(work, struct rfcomm_dev,
+						pending_work.work);
+	struct tty_struct *tty;
+
+	if (!rfcomm_tty_copy_pending(dev))
+		return;
+
+	/* Backlog is gone, resume unless the ldisc throttled us */
+	tty = tty_port_tty_get(&dev->port);
+	if (!tty || !test_bit(TTY_THROTTLED, &tty->flags))
+		rfcomm_dlc_unthrottle(dev->dlc);
+	tty_kref_put(tty);
+}
+
+/* From open() and unthrottle(). Pushing the flip buffer here could run
+ * the ldisc under its own read locks, leave the backlog to pending_work. */
+void RFCOMM_TTY::rfcomm_tty_kick_pending(struct rfcomm_dev *dev)
+{
+	if (skb_queue_empty(&dev->pending))
+		rfcomm_dlc_unthrottle(dev->dlc);
+	else
+		mod_delayed_work(system_wq, &dev->pending_work, 0);
 }
 
 int RFCOMM_TTY::rfcomm_tty_open(struct tty_struct *tty, struct file *filp)
@@ -640,13 +909,14 @@ int RFCOMM_TTY::rfcomm_tty_open(struct tty_struct *tty, struct file *filp)
 	set_current_state(TASK_RUNNING);
 	remove_wait_queue(&dev->wait, &wait);
 
-	if (err == 0)
+	if (err == 0) {
 		device_move(dev->tty_dev, rfcomm_get_device(dev),
 			    DPM_ORDER_DEV_AFTER_PARENT);
 
-	rfcomm_tty_copy_pending(dev);
+		rfcomm_dev_pool_fill(dev);
+	}
 
-	rfcomm_dlc_unthrottle(dev->dlc);
+	rfcomm_tty_kick_pending(dev);
 
 	return err;
 }
@@ -668,6 +938,10 @@ void RFCOMM_TTY::rfcomm_tty_close(struct tty_struct *tty, struct file *filp)
 		if (dev->tty_dev->parent)
 			device_move(dev->tty_dev, NULL, DPM_ORDER_DEV_LAST);
 
+		/* Send what is held back before the DLC goes */
+		rfcomm_dev_tx_flush(dev);
+		del_timer_sync(&dev->tx_timer);
+
 		/* Close DLC and dettach TTY */
 		rfcomm_dlc_close(dev->dlc, 0);
 
@@ -679,9 +953,7 @@ void RFCOMM_TTY::rfcomm_tty_close(struct tty_struct *tty, struct file *filp)
 		rfcomm_dlc_unlock(dev->dlc);
 
 		if (test_bit(RFCOMM_TTY_RELEASED, &dev->flags)) {
-			spin_lock(&rfcomm_dev_lock);
-			list_del_init(&dev->list);
-			spin_unlock(&rfcomm_dev_lock);
+			rfcomm_dev_unlink(dev);
 
 			tty_port_put(&dev->port);
 		}
@@ -695,33 +967,74 @@ int RFCOMM_TTY::rfcomm_tty_write(struct tty_struct *tty, const unsigned char *bu
 {
 	struct rfcomm_dev *dev = (struct rfcomm_dev *) tty->driver_data;
 	struct rfcomm_dlc *dlc = dev->dlc;
-	struct sk_buff *skb;
+	struct sk_buff *skb, *drop = NULL;
+	bool coalesce = test_bit(RFCOMM_TX_COALESCE, &dev->flags);
+	unsigned long flags;
 	int err = 0, sent = 0, size;
 
 	BT_DBG("tty %p count %d", tty, count);
 
+	/* A flush of tx_tail from the timer must not overtake us */
+	spin_lock_irqsave(&dev->tx_lock, flags);
+
 	while (count) {
-		size = min_t(uint, count, dlc->mtu);
+		/* Top up the frame held back by an earlier write first */
+		skb = dev->tx_tail;
+		dev->tx_tail = NULL;
 
-		skb = rfcomm_wmalloc(dev, size + RFCOMM_SKB_RESERVE, GFP_ATOMIC);
+		if (!skb) {
+			size = coalesce ? dlc->mtu : min_t(uint, count, dlc->mtu);
 
-		if (!skb)
-			break;
+			skb = rfcomm_wmalloc(dev, size + RFCOMM_SKB_RESERVE, GFP_ATOMIC);
+
+			if (!skb)
+				break;
+
+			skb_reserve(skb, RFCOMM_SKB_HEAD_RESERVE);
+		}
 
-		skb_reserve(skb, RFCOMM_SKB_HEAD_RESERVE);
+		size = min_t(uint, count, dlc->mtu - skb->len);
 
 		memcpy(skb_put(skb, size), buf + sent, size);
 
-		err = rfcomm_dlc_send(dlc, skb);
-		if (err < 0) {
-			kfree_skb(skb);
-			break;
+		/* Accounted before the send, krfcommd may complete it
+		 * right away. A failed send undoes it in rfcomm_wfree(). */
+		rfcomm_skb_cb(skb)->len += size;
+		atomic_add(size, &dev->tx_bytes);
+
+		if (coalesce && skb->len < dlc->mtu) {
+			/* Sent when full or when tx_timer fires. The timer
+			 * runs from when the frame was started. */
+			if (!timer_pending(&dev->tx_timer))
+				mod_timer(&dev->tx_timer, jiffies +
+					usecs_to_jiffies(tty_coalesce_usecs));
+			dev->tx_tail = skb;
+		} else {
+			err = rfcomm_dlc_send(dlc, skb);
+			if (err < 0) {
+				drop = skb;
+				break;
+			}
 		}
 
 		sent  += size;
 		count -= size;
 	}
 
+	/* Nothing held back any more */
+	if (!dev->tx_tail)
+		del_timer(&dev->tx_timer);
+
+	spin_unlock_irqrestore(&dev->tx_lock, flags);
+
+	kfree_skb(drop);
+
+	if (sent) {
+		rfcomm_dlc_lock(dlc);
+		dev->icount.tx += sent;
+		rfcomm_dlc_unlock(dlc);
+	}
+
 	return sent ? sent : err;
 }
 
@@ -742,8 +1055,78 @@ int RFCOMM_TTY::rfcomm_tty_write_room(struct tty_struct *tty)
 	return room;
 }
 
+int RFCOMM_TTY::rfcomm_tty_get_serial(struct rfcomm_dev *dev, struct serial_struct __user *ss)
+{
+	struct serial_struct tmp;
+
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.type = PORT_UNKNOWN;
+	tmp.line = dev->id;
+	tmp.xmit_fifo_size = dev->dlc->mtu;
+
+	if (test_bit(RFCOMM_LOW_LATENCY, &dev->flags))
+		tmp.flags |= ASYNC_LOW_LATENCY;
+
+	if (copy_to_user(ss, &tmp, sizeof(tmp)))
+		return -EFAULT;
+
+	return 0;
+}
+
+/* Only ASYNC_LOW_LATENCY means anything for an RFCOMM port */
+int RFCOMM_TTY::rfcomm_tty_set_serial(struct rfcomm_dev *dev, struct serial_struct __user *ss)
+{
+	struct serial_struct tmp;
+
+	if (copy_from_user(&tmp, ss, sizeof(tmp)))
+		return -EFAULT;
+
+	rfcomm_dev_set_low_latency(dev, tmp.flags & ASYNC_LOW_LATENCY);
+	return 0;
+}
+
+/* Has any line in mask changed since prev was taken? */
+bool RFCOMM_TTY::rfcomm_tty_msr_changed(struct rfcomm_dev *dev, unsigned long mask,
+				struct async_icount *prev)
+{
+	struct async_icount cnow;
+
+	rfcomm_dlc_lock(dev->dlc);
+	cnow = dev->icount;
+	rfcomm_dlc_unlock(dev->dlc);
+
+	return	((mask & TIOCM_RNG) && cnow.rng != prev->rng) ||
+		((mask & TIOCM_DSR) && cnow.dsr != prev->dsr) ||
+		((mask & TIOCM_CD)  && cnow.dcd != prev->dcd) ||
+		((mask & TIOCM_CTS) && cnow.cts != prev->cts);
+}
+
+int RFCOMM_TTY::rfcomm_tty_wait_msr(struct rfcomm_dev *dev, unsigned long mask)
+{
+	struct async_icount cprev;
+	int err;
+
+	rfcomm_dlc_lock(dev->dlc);
+	cprev = dev->icount;
+	rfcomm_dlc_unlock(dev->dlc);
+
+	/* Woken by rfcomm_dev_modem_status() and on DLC state changes */
+	err = wait_event_interruptible(dev->port.delta_msr_wait,
+			rfcomm_tty_msr_changed(dev, mask, &cprev) ||
+			dev->dlc->state != BT_CONNECTED);
+	if (err)
+		return err;
+
+	if (dev->dlc->state != BT_CONNECTED)
+		return -EIO;
+
+	return 0;
+}
+
 int RFCOMM_TTY::rfcomm_tty_ioctl(struct tty_struct *tty, unsigned int cmd, unsigned long arg)
 {
+	struct rfcomm_dev *dev = (struct rfcomm_dev *) tty->driver_data;
+
 	BT_DBG("tty %p cmd 0x%02x", tty, cmd);
 
 	switch (cmd) {
@@ -757,15 +1140,13 @@ int RFCOMM_TTY::rfcomm_tty_ioctl(struct tty_struct *tty, unsigned int cmd, unsig
 
 	case TIOCMIWAIT:
 		BT_DBG("TIOCMIWAIT");
-		break;
+		return rfcomm_tty_wait_msr(dev, arg);
 
 	case TIOCGSERIAL:
-		BT_ERR("TIOCGSERIAL is not supported");
-		return -ENOIOCTLCMD;
+		return rfcomm_tty_get_serial(dev, (struct serial_struct __user *) arg);
 
 	case TIOCSSERIAL:
-		BT_ERR("TIOCSSERIAL is not supported");
-		return -ENOIOCTLCMD;
+		return rfcomm_tty_set_serial(dev, (struct serial_struct __user *) arg);
 
 	case TIOCSERGSTRUCT:
 		BT_ERR("TIOCSERGSTRUCT is not supported");
@@ -941,7 +1322,7 @@ void RFCOMM_TTY::rfcomm_tty_unthrottle(struct tty_struct *tty)
 
 	BT_DBG("tty %p dev %p", tty, dev);
 
-	rfcomm_dlc_unthrottle(dev->dlc);
+	rfcomm_tty_kick_pending(dev);
 }
 
 int RFCOMM_TTY::rfcomm_tty_chars_in_buffer(struct tty_struct *tty)
@@ -953,21 +1334,28 @@ int RFCOMM_TTY::rfcomm_tty_chars_in_buffer(struct tty_struct *tty)
 	if (!dev || !dev->dlc)
 		return 0;
 
-	if (!skb_queue_empty(&dev->dlc->tx_queue))
-		return dev->dlc->mtu;
-
-	return 0;
+	return max(atomic_read(&dev->tx_bytes), 0);
 }
 
 void RFCOMM_TTY::rfcomm_tty_flush_buffer(struct tty_struct *tty)
 {
 	struct rfcomm_dev *dev = (struct rfcomm_dev *) tty->driver_data;
+	struct sk_buff *skb;
+	unsigned long flags;
 
 	BT_DBG("tty %p dev %p", tty, dev);
 
 	if (!dev || !dev->dlc)
 		return;
 
+	spin_lock_irqsave(&dev->tx_lock, flags);
+	skb = dev->tx_tail;
+	dev->tx_tail = NULL;
+	del_timer(&dev->tx_timer);
+	spin_unlock_irqrestore(&dev->tx_lock, flags);
+
+	kfree_skb(skb);
+
 	skb_queue_purge(&dev->dlc->tx_queue);
 	tty_wakeup(tty);
 }
@@ -979,7 +1367,21 @@ void RFCOMM_TTY::rfcomm_tty_send_xchar(struct tty_struct *tty, char ch)
 
 void RFCOMM_TTY::rfcomm_tty_wait_until_sent(struct tty_struct *tty, int timeout)
 {
+	struct rfcomm_dev *dev = (struct rfcomm_dev *) tty->driver_data;
+
 	BT_DBG("tty %p timeout %d", tty, timeout);
+
+	if (!dev || !dev->dlc)
+		return;
+
+	/* Nothing to hold back for once someone waits on it */
+	rfcomm_dev_tx_flush(dev);
+
+	/* Woken by rfcomm_dev_tx_sent() and on DLC state changes */
+	wait_event_interruptible_timeout(dev->wait,
+			atomic_read(&dev->tx_bytes) <= 0 ||
+			dev->dlc->state != BT_CONNECTED,
+			timeout ? timeout : MAX_SCHEDULE_TIMEOUT);
 }
 
 void RFCOMM_TTY::rfcomm_tty_hangup(struct tty_struct *tty)
@@ -1043,6 +1445,27 @@ int RFCOMM_TTY::rfcomm_tty_tiocmset(struct tty_struct *tty, unsigned int set, un
 	return 0;
 }
 
+int RFCOMM_TTY::rfcomm_tty_get_icount(struct tty_struct *tty, struct serial_icounter_struct *icount)
+{
+	struct rfcomm_dev *dev = (struct rfcomm_dev *) tty->driver_data;
+	struct async_icount cnow;
+
+	BT_DBG("tty %p dev %p", tty, dev);
+
+	rfcomm_dlc_lock(dev->dlc);
+	cnow = dev->icount;
+	rfcomm_dlc_unlock(dev->dlc);
+
+	icount->cts = cnow.cts;
+	icount->dsr = cnow.dsr;
+	icount->rng = cnow.rng;
+	icount->dcd = cnow.dcd;
+	icount->rx  = cnow.rx;
+	icount->tx  = cnow.tx;
+
+	return 0;
+}
+
 
 /*** PUBLIC METHODS */
 // tty port oper
@@ -1111,6 +1534,10 @@ static int rfcomm_tty_tiocmset(struct tty_struct *tty, unsigned int set, unsigne
 	return rfcomm_tty.rfcomm_tty_tiocmset(tty, set, clear);
 }
 
+static int rfcomm_tty_get_icount(struct tty_struct *tty, struct serial_icounter_struct *icount){
+	return rfcomm_tty.rfcomm_tty_get_icount(tty, icount);
+}
+
 extern "C"{
 	static struct tty_driver *rfcomm_tty_driver;
 
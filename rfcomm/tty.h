@@ -31,25 +31,45 @@
 #include <linux/tty.h>
 #include <linux/tty_driver.h>
 #include <linux/tty_flip.h>
+#include <linux/serial.h>
 
 #include <net/bluetooth/bluetooth.h>
 #include <net/bluetooth/hci_core.h>
 #include <net/bluetooth/rfcomm.h>
+
+#include "rfcomm_ext.h"
 #include <c++/end_include.h>
 
 #define RFCOMM_TTY_MAGIC 0x6d02		/* magic number for rfcomm struct */
-#define RFCOMM_TTY_PORTS RFCOMM_MAX_DEV	/* whole lotta rfcomm devices */
+#define RFCOMM_TTY_PORTS 4096		/* whole lotta rfcomm devices */
 #define RFCOMM_TTY_MAJOR 216		/* device node major id of the usb/bluetooth.c driver */
 #define RFCOMM_TTY_MINOR 0
 
+/* Retry interval for RX data the flip buffer couldn't take while
+ * the tty is open and unthrottled */
+#define RFCOMM_TTY_PENDING_RETRY	msecs_to_jiffies(10)
+
 
 /* ---- Device IOCTLs ---- */
 
+/* Device flag, also accepted in rfcomm_dev_req.flags: received data is
+ * handed to the line discipline from krfcommd, without the flip buffer
+ * work in between. Same as setserial's low_latency. */
+#define RFCOMM_LOW_LATENCY	8
+
+/* Device flag, also accepted in rfcomm_dev_req.flags: small writes are
+ * appended to a held back frame, which is sent once it reaches the MTU
+ * or after tty_coalesce_usecs. */
+#define RFCOMM_TX_COALESCE	9
+
 #define NOCAP_FLAGS ((1 << RFCOMM_REUSE_DLC) | (1 << RFCOMM_RELEASE_ONHUP))
 
+/* Flags that don't need CAP_NET_ADMIN on top of NOCAP_FLAGS */
+#define RFCOMM_TTY_USER_FLAGS ((1 << RFCOMM_LOW_LATENCY) | (1 << RFCOMM_TX_COALESCE))
+
 struct rfcomm_dev {
 	struct tty_port		port;
-	struct list_head	list;
+	struct rcu_head		rcu;
 
 	char			name[12];
 	int			id;
@@ -62,17 +82,45 @@ struct rfcomm_dev {
 
 	uint			modem_status;
 
+	/* Modem line transitions and byte counts, for TIOCMIWAIT and
+	 * TIOCGICOUNT. Updated under the DLC lock. */
+	struct async_icount	icount;
+
 	struct rfcomm_dlc	*dlc;
 	wait_queue_head_t       wait;
 
+	/* Payload bytes written but not yet handed to L2CAP, waiters on
+	 * wait are woken when it drops to zero. */
+	atomic_t		tx_bytes;
+
 	struct device		*tty_dev;
 
 	atomic_t		wmem_alloc;
 
+	/* Sent skbs are recycled here instead of being freed, up to one
+	 * credit window worth. tx_done counts completions since the
+	 * last tty_wakeup(). */
+	struct sk_buff_head	tx_pool;
+	unsigned int		tx_pool_size;
+	unsigned int		tx_done;
+
+	/* Partial frame held back by RFCOMM_TX_COALESCE, sent by
+	 * tx_timer. tx_lock also keeps writes and that send in order. */
+	spinlock_t		tx_lock;
+	struct sk_buff		*tx_tail;
+	struct timer_list	tx_timer;
+
+	/* RX data the flip buffer couldn't take, the DLC stays
+	 * throttled until it has been moved over. pending_work only
+	 * retries while the tty is open and unthrottled, open() and
+	 * unthrottle() kick it for the rest. */
 	struct sk_buff_head	pending;
+	struct delayed_work	pending_work;
 };
 
-static LIST_HEAD(rfcomm_dev_list);
+/* Devices by id. Lookups only take rcu_read_lock(), rfcomm_dev_lock
+ * serializes adding and removing entries. */
+static DEFINE_IDR(rfcomm_dev_idr);
 static DEFINE_SPINLOCK(rfcomm_dev_lock);
 
 static DEVICE_ATTR(address, S_IRUGO, show_address, NULL);
@@ -89,7 +137,7 @@ static void rfcomm_dev_modem_status(struct rfcomm_dlc *dlc, u8 v24_sig);
 /*
  * The reason this isn't actually a race, as you no doubt have a little voice
  * screaming at you in your head, is that the refcount should never actually
- * reach zero unless the device has already been taken off the list, in
+ * reach zero unless the device has already been taken out of the idr, in
  * rfcomm_dev_del(). And if that's not true, we'll hit the BUG() in
  * rfcomm_dev_destruct() anyway.
  */
@@ -110,6 +158,8 @@ private:
 
 	void rfcomm_dev_del(struct rfcomm_dev *dev);
 
+	void rfcomm_dev_unlink(struct rfcomm_dev *dev);
+
 	/* ---- Send buffer ---- */
 	inline unsigned int rfcomm_room(struct rfcomm_dlc *dlc);
 
@@ -119,6 +169,14 @@ private:
 
 	struct sk_buff *rfcomm_wmalloc(struct rfcomm_dev *dev, unsigned long size, gfp_t priority);
 
+	void rfcomm_dev_tx_sent(struct rfcomm_dev *dev, struct sk_buff *skb);
+
+	void rfcomm_dev_pool_fill(struct rfcomm_dev *dev);
+
+	void rfcomm_dev_tx_flush(struct rfcomm_dev *dev);
+
+	void rfcomm_dev_tx_timeout(unsigned long arg);
+
 	/* ---- Device IOCTLs ---- */
 
 	int rfcomm_create_dev(struct sock *sk, void __user *arg);
@@ -131,6 +189,17 @@ private:
 
 	int rfcomm_dev_ioctl(struct sock *sk, unsigned int cmd, void __user *arg);
 
+	void rfcomm_dev_set_low_latency(struct rfcomm_dev *dev, bool on);
+
+	int rfcomm_tty_get_serial(struct rfcomm_dev *dev, struct serial_struct __user *ss);
+
+	int rfcomm_tty_set_serial(struct rfcomm_dev *dev, struct serial_struct __user *ss);
+
+	bool rfcomm_tty_msr_changed(struct rfcomm_dev *dev, unsigned long mask,
+				struct async_icount *prev);
+
+	int rfcomm_tty_wait_msr(struct rfcomm_dev *dev, unsigned long mask);
+
 	/* ---- DLC callbacks ---- */
 	void rfcomm_dev_data_ready(struct rfcomm_dlc *dlc, struct sk_buff *skb);
 
@@ -138,8 +207,20 @@ private:
 
 	void rfcomm_dev_modem_status(struct rfcomm_dlc *dlc, u8 v24_sig);
 
+	void rfcomm_dev_tx_done(struct rfcomm_dlc *dlc, struct sk_buff *skb);
+
+	void rfcomm_dev_rx_flush(struct rfcomm_dlc *dlc);
+
 	/* ---- TTY functions ---- */
-	void rfcomm_tty_copy_pending(struct rfcomm_dev *dev);
+	int rfcomm_tty_fill_flip(struct rfcomm_dev *dev, struct sk_buff *skb);
+
+	bool rfcomm_tty_copy_pending(struct rfcomm_dev *dev);
+
+	void rfcomm_tty_pending_retry(struct rfcomm_dev *dev);
+
+	void rfcomm_tty_kick_pending(struct rfcomm_dev *dev);
+
+	void rfcomm_tty_pending_work(struct work_struct *work);
 
 public:
 	void rfcomm_dev_destruct(struct tty_port *port);
@@ -173,6 +254,8 @@ public:
 	int rfcomm_tty_tiocmget(struct tty_struct *tty);
 
 	int rfcomm_tty_tiocmset(struct tty_struct *tty, unsigned int set, unsigned int clear);	
+
+	int rfcomm_tty_get_icount(struct tty_struct *tty, struct serial_icounter_struct *icount);
 }rfcomm_tty;
 
 // tty port oper
@@ -209,6 +292,8 @@ static int rfcomm_tty_tiocmget(struct tty_struct *tty);
 
 static int rfcomm_tty_tiocmset(struct tty_struct *tty, unsigned int set, unsigned int clear);
 
+static int rfcomm_tty_get_icount(struct tty_struct *tty, struct serial_icounter_struct *icount);
+
 /* ---- TTY structure ---- */
 static const struct tty_operations rfcomm_ops = {
 	.open				= rfcomm_tty_open,
@@ -226,6 +311,7 @@ static const struct tty_operations rfcomm_ops = {
 	.wait_until_sent	= rfcomm_tty_wait_until_sent,
 	.tiocmget			= rfcomm_tty_tiocmget,
 	.tiocmset			= rfcomm_tty_tiocmset,
+	.get_icount			= rfcomm_tty_get_icount,
 };
 
 static const struct tty_port_operations rfcomm_port_ops = {
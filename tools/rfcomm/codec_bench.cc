@@ -0,0 +1,249 @@
+/*
+ * RFCOMM frame codec benchmark.
+ *
+ * Encodes, decodes and checksums a fixed mix of frames with the same
+ * codec the kernel module uses and reports frames per second.
+ *
+ * Usage: codec_bench [rounds]
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "skb_shim.h"
+#include "codec.h"
+
+#define NR_FRAMES	4096
+#define DEFAULT_ROUNDS	2000
+#define MAX_PAYLOAD	1008	/* DLC MTU on a default L2CAP MTU */
+#define HEAD_ROOM	4
+#define FRAME_SIZE	(HEAD_ROOM + MAX_PAYLOAD + 1)
+
+enum frame_kind { KIND_DATA, KIND_CREDITS, KIND_MSC };
+
+/* Rough traffic of a serial port profile link. Interactive use is
+ * mostly tiny frames, bulk transfers fill the MTU. */
+static const struct frame_mix {
+	enum frame_kind	kind;
+	int		min, max;
+	int		weight;
+} mix[] = {
+	{ KIND_CREDITS,	0,	0,		10 },
+	{ KIND_MSC,	0,	0,		 2 },
+	{ KIND_DATA,	1,	8,		28 },
+	{ KIND_DATA,	127,	127,		20 },
+	{ KIND_DATA,	128,	512,		15 },
+	{ KIND_DATA,	MAX_PAYLOAD, MAX_PAYLOAD, 25 },
+};
+
+struct frame {
+	enum frame_kind	kind;
+	int		plen;
+	u8		addr;
+	struct sk_buff	*skb;
+	u8		data[MAX_PAYLOAD];	/* user payload */
+	u8		wire[FRAME_SIZE];
+	int		wire_len;
+};
+
+static struct frame frames[NR_FRAMES];
+static volatile unsigned long sink;
+
+static unsigned int rnd_state = 12345;
+
+static unsigned int rnd(void)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return rnd_state >> 8;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const struct frame_mix *pick_mix(void)
+{
+	int total = 0, i, r;
+
+	for (i = 0; i < (int) (sizeof(mix) / sizeof(mix[0])); i++)
+		total += mix[i].weight;
+
+	r = rnd() % total;
+	for (i = 0; r >= mix[i].weight; i++)
+		r -= mix[i].weight;
+
+	return &mix[i];
+}
+
+/* One frame, payload copied in behind HEAD_ROOM like sendmsg does */
+static int encode_one(struct frame *f)
+{
+	struct sk_buff *skb = f->skb;
+	u8 msc[2];
+
+	switch (f->kind) {
+	case KIND_CREDITS:
+		return rfcomm_put_credits(f->wire, f->addr, 7);
+
+	case KIND_MSC:
+		msc[0] = __addr(1, __get_dlci(f->addr));
+		msc[1] = 0x8d;
+		return rfcomm_put_mcc(f->wire, __addr(1, 0), 1, RFCOMM_MSC,
+						msc, sizeof(msc));
+
+	default:
+		skb->data = skb->head + HEAD_ROOM;
+		skb->len  = f->plen;
+		skb->tail = skb->data + f->plen;
+		memcpy(skb->data, f->data, f->plen);
+		rfcomm_push_uih(skb, f->addr);
+		return skb->len;
+	}
+}
+
+static void setup(void)
+{
+	struct frame *f;
+	int i, j, channel;
+
+	for (i = 0; i < NR_FRAMES; i++) {
+		const struct frame_mix *m = pick_mix();
+
+		f = &frames[i];
+		f->kind = m->kind;
+		f->plen = m->min + rnd() % (m->max - m->min + 1);
+		channel = 1 + rnd() % 30;
+		f->addr = __addr(1, __dlci(0, channel));
+
+		f->skb = alloc_skb(FRAME_SIZE);
+		if (!f->skb) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+
+		for (j = 0; j < f->plen; j++)
+			f->data[j] = rnd();
+
+		f->wire_len = encode_one(f);
+		if (f->kind == KIND_DATA)
+			memcpy(f->wire, f->skb->data, f->wire_len);
+	}
+}
+
+/* Encoded frames must parse back to what went in */
+static void verify(void)
+{
+	struct rfcomm_frame rf;
+	struct rfcomm_mcc_msg m;
+	int i;
+
+	for (i = 0; i < NR_FRAMES; i++) {
+		struct frame *f = &frames[i];
+
+		if (rfcomm_parse_frame(f->wire, f->wire_len, &rf) ||
+				rf.type != RFCOMM_UIH)
+			goto bad;
+
+		switch (f->kind) {
+		case KIND_CREDITS:
+			if (!rf.pf || rf.len != 1 || rf.data[0] != 7)
+				goto bad;
+			break;
+
+		case KIND_MSC:
+			if (rf.dlci || rfcomm_parse_mcc(rf.data, rf.len, &m) != 2 ||
+					m.type != RFCOMM_MSC || m.len != 2)
+				goto bad;
+			break;
+
+		default:
+			if (rf.addr != f->addr || rf.len != f->plen ||
+					memcmp(rf.data, f->data, f->plen))
+				goto bad;
+			break;
+		}
+	}
+
+	return;
+
+bad:
+	fprintf(stderr, "frame %d doesn't round trip\n", i);
+	exit(1);
+}
+
+/* MB/s only means something for passes that touch every payload
+ * byte, header-only passes give bytes == 0 */
+static void report(const char *name, int rounds, double t, unsigned long bytes)
+{
+	double n = (double) rounds * NR_FRAMES;
+
+	printf("%-8s %8.2f Mframes/s ", name, n / t / 1e6);
+	if (bytes)
+		printf("%8.1f MB/s ", bytes * (double) rounds / t / 1e6);
+	else
+		printf("%13s ", "");
+	printf("%6.1f ns/frame\n", t / n * 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+	struct rfcomm_frame rf;
+	struct rfcomm_mcc_msg m;
+	unsigned long bytes = 0, acc = 0;
+	int rounds = DEFAULT_ROUNDS, r, i;
+	double t;
+
+	if (argc > 1)
+		rounds = atoi(argv[1]);
+	if (rounds <= 0) {
+		fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	setup();
+	verify();
+
+	for (i = 0; i < NR_FRAMES; i++)
+		bytes += frames[i].wire_len;
+
+	printf("%d frames, %.1f bytes average, %d rounds\n", NR_FRAMES,
+			(double) bytes / NR_FRAMES, rounds);
+
+	t = now();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < NR_FRAMES; i++)
+			acc += encode_one(&frames[i]);
+	report("encode", rounds, now() - t, bytes);
+
+	t = now();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < NR_FRAMES; i++) {
+			struct frame *f = &frames[i];
+
+			if (rfcomm_parse_frame(f->wire, f->wire_len, &rf))
+				continue;
+			acc += rf.len;
+			if (!rf.dlci && rfcomm_parse_mcc(rf.data, rf.len, &m) > 0)
+				acc += m.type;
+		}
+	report("decode", rounds, now() - t, 0);
+
+	/* Header FCS of a UIH frame, header and type check of the rest */
+	t = now();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < NR_FRAMES; i++) {
+			struct frame *f = &frames[i];
+
+			acc += __fcs(f->wire);
+			acc += __check_fcs(f->wire, RFCOMM_UIH,
+						f->wire[f->wire_len - 1]);
+		}
+	report("fcs", rounds, now() - t, 0);
+
+	sink = acc;
+	return 0;
+}
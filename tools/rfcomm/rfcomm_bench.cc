@@ -0,0 +1,549 @@
+/*
+ * RFCOMM end to end benchmark.
+ *
+ * Runs both ends of the link on one host, from the adapter with
+ * address src to the one with address dst. Without radios, use two
+ * virtual controllers: load hci_vhci and connect a pair of them with
+ * BlueZ's emulator, e.g. "btvirt -l2". That's still the real L2CAP and
+ * HCI path, only the air interface is emulated.
+ *
+ * Usage: rfcomm_bench -a src -b dst [-t test] [-c channel] [-s size]
+ *                     [-n count] [-d dlcs] [-i tty id]
+ *
+ * Tests:
+ *   sock     socket throughput, count KB in size byte writes
+ *   tty      the same through /dev/rfcomm<tty id>
+ *   latency  count round trips of size bytes
+ *   mux      socket throughput on dlcs DLCs of one session at once
+ *   connect  count DLC connects and disconnects
+ *   all      all of the above (default)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+
+/* From <bluetooth/bluetooth.h> and <bluetooth/rfcomm.h>, so this
+ * builds without the BlueZ headers */
+#ifndef AF_BLUETOOTH
+#define AF_BLUETOOTH	31
+#endif
+#define BTPROTO_RFCOMM	3
+
+typedef struct {
+	uint8_t b[6];
+} __attribute__((packed)) bdaddr_t;
+
+struct sockaddr_rc {
+	sa_family_t	rc_family;
+	bdaddr_t	rc_bdaddr;
+	uint8_t		rc_channel;
+};
+
+struct rfcomm_dev_req {
+	int16_t		dev_id;
+	uint32_t	flags;
+	bdaddr_t	src;
+	bdaddr_t	dst;
+	uint8_t		channel;
+};
+
+#define RFCOMMCREATEDEV		_IOW('R', 200, int)
+#define RFCOMMRELEASEDEV	_IOW('R', 201, int)
+
+static bdaddr_t src, dst;
+static int channel = 10;
+static int size = 1000;
+static long count = 0;
+static int dlcs = 8;
+static int tty_id = 32;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int str2ba(const char *str, bdaddr_t *ba)
+{
+	unsigned int b[6];
+	int i;
+
+	if (sscanf(str, "%x:%x:%x:%x:%x:%x", &b[5], &b[4], &b[3], &b[2],
+						&b[1], &b[0]) != 6)
+		return -1;
+
+	for (i = 0; i < 6; i++)
+		ba->b[i] = b[i];
+
+	return 0;
+}
+
+static int rc_listen(int chan)
+{
+	struct sockaddr_rc addr;
+	int sk;
+
+	sk = socket(AF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
+	if (sk < 0)
+		die("socket");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.rc_family  = AF_BLUETOOTH;
+	addr.rc_bdaddr  = dst;
+	addr.rc_channel = chan;
+
+	if (bind(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		die("bind");
+
+	if (listen(sk, 32) < 0)
+		die("listen");
+
+	return sk;
+}
+
+static int rc_connect(int chan)
+{
+	struct sockaddr_rc addr;
+	int sk;
+
+	sk = socket(AF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
+	if (sk < 0)
+		die("socket");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.rc_family = AF_BLUETOOTH;
+	addr.rc_bdaddr = src;
+
+	if (bind(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		die("bind");
+
+	addr.rc_bdaddr  = dst;
+	addr.rc_channel = chan;
+
+	if (connect(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		die("connect");
+
+	return sk;
+}
+
+static int rc_accept(int lsk)
+{
+	int sk = accept(lsk, NULL, NULL);
+
+	if (sk < 0)
+		die("accept");
+
+	return sk;
+}
+
+static void read_full(int fd, char *buf, long len)
+{
+	while (len > 0) {
+		ssize_t n = read(fd, buf, len);
+
+		if (n <= 0)
+			die("read");
+
+		buf += n;
+		len -= n;
+	}
+}
+
+static void write_full(int fd, const char *buf, long len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			die("write");
+		}
+
+		buf += n;
+		len -= n;
+	}
+}
+
+/* ---- Throughput ---- */
+
+struct stream {
+	int		tx, rx;
+	long		total;
+	pthread_t	reader, writer;
+	double		start, end;
+};
+
+static void *stream_reader(void *arg)
+{
+	struct stream *st = (struct stream *) arg;
+	char *buf = (char *) malloc(size);
+	long left = st->total;
+
+	while (left > 0) {
+		ssize_t n = read(st->rx, buf, std::min<long>(left, size));
+
+		if (n <= 0)
+			die("read");
+
+		left -= n;
+	}
+
+	st->end = now();
+	free(buf);
+	return NULL;
+}
+
+static void *stream_writer(void *arg)
+{
+	struct stream *st = (struct stream *) arg;
+	char *buf = (char *) malloc(size);
+	long left = st->total;
+
+	memset(buf, 0x5a, size);
+
+	while (left > 0) {
+		long n = std::min<long>(left, size);
+
+		write_full(st->tx, buf, n);
+		left -= n;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void stream_start(struct stream *st)
+{
+	st->start = now();
+	pthread_create(&st->reader, NULL, stream_reader, st);
+	pthread_create(&st->writer, NULL, stream_writer, st);
+}
+
+static void stream_wait(struct stream *st)
+{
+	pthread_join(st->writer, NULL);
+	pthread_join(st->reader, NULL);
+}
+
+static double stream_rate(struct stream *st)
+{
+	return st->total / (st->end - st->start) / 1024;
+}
+
+static void test_sock(void)
+{
+	struct stream st;
+	int lsk;
+
+	lsk = rc_listen(channel);
+	st.tx = rc_connect(channel);
+	st.rx = rc_accept(lsk);
+	st.total = (count ? count : 4096) * 1024;
+
+	stream_start(&st);
+	stream_wait(&st);
+
+	printf("sock     %ld KB in %d byte writes: %.1f KB/s\n",
+			st.total / 1024, size, stream_rate(&st));
+
+	close(st.tx);
+	close(st.rx);
+	close(lsk);
+}
+
+static void test_tty(void)
+{
+	struct rfcomm_dev_req req;
+	struct termios ti;
+	struct stream st;
+	char path[32];
+	int ctl, lsk;
+
+	ctl = socket(AF_BLUETOOTH, SOCK_RAW, BTPROTO_RFCOMM);
+	if (ctl < 0)
+		die("socket");
+
+	lsk = rc_listen(channel);
+
+	memset(&req, 0, sizeof(req));
+	req.dev_id  = tty_id;
+	req.src     = src;
+	req.dst     = dst;
+	req.channel = channel;
+
+	if (ioctl(ctl, RFCOMMCREATEDEV, &req) < 0)
+		die("RFCOMMCREATEDEV");
+
+	/* Opening the TTY connects the DLC */
+	snprintf(path, sizeof(path), "/dev/rfcomm%d", tty_id);
+	st.tx = open(path, O_RDWR | O_NOCTTY);
+	if (st.tx < 0)
+		die(path);
+
+	tcgetattr(st.tx, &ti);
+	cfmakeraw(&ti);
+	tcsetattr(st.tx, TCSANOW, &ti);
+
+	st.rx = rc_accept(lsk);
+	st.total = (count ? count : 4096) * 1024;
+
+	stream_start(&st);
+	stream_wait(&st);
+
+	printf("tty      %ld KB in %d byte writes: %.1f KB/s\n",
+			st.total / 1024, size, stream_rate(&st));
+
+	close(st.tx);
+	close(st.rx);
+	close(lsk);
+
+	ioctl(ctl, RFCOMMRELEASEDEV, &req);
+	close(ctl);
+}
+
+static void test_mux(void)
+{
+	struct stream *st = new struct stream[dlcs];
+	int *lsk = new int[dlcs];
+	double lo = 0, hi = 0, start, end = 0;
+	long total = 0;
+	int i;
+
+	if (channel + dlcs - 1 > 30) {
+		fprintf(stderr, "mux: channels %d to %d don't fit\n",
+					channel, channel + dlcs - 1);
+		exit(1);
+	}
+
+	/* One server channel per DLC, they all share the session */
+	for (i = 0; i < dlcs; i++) {
+		lsk[i] = rc_listen(channel + i);
+		st[i].tx = rc_connect(channel + i);
+		st[i].rx = rc_accept(lsk[i]);
+		st[i].total = (count ? count : 1024) * 1024;
+	}
+
+	start = now();
+	for (i = 0; i < dlcs; i++)
+		stream_start(&st[i]);
+
+	for (i = 0; i < dlcs; i++) {
+		double rate;
+
+		stream_wait(&st[i]);
+
+		rate = stream_rate(&st[i]);
+		lo = i ? std::min(lo, rate) : rate;
+		hi = std::max(hi, rate);
+		end = std::max(end, st[i].end);
+		total += st[i].total;
+
+		close(st[i].tx);
+		close(st[i].rx);
+		close(lsk[i]);
+	}
+
+	printf("mux      %d DLCs: %.1f KB/s total, %.1f to %.1f KB/s per DLC\n",
+			dlcs, total / (end - start) / 1024, lo, hi);
+
+	delete[] st;
+	delete[] lsk;
+}
+
+/* ---- Latency ---- */
+
+struct echo {
+	int	sk;
+	long	rounds;
+};
+
+static void *echo_thread(void *arg)
+{
+	struct echo *e = (struct echo *) arg;
+	char *buf = (char *) malloc(size);
+	long i;
+
+	for (i = 0; i < e->rounds; i++) {
+		read_full(e->sk, buf, size);
+		write_full(e->sk, buf, size);
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void test_latency(void)
+{
+	long i, rounds = count ? count : 10000;
+	double *rtt = new double[rounds], sum = 0;
+	char *buf = (char *) malloc(size);
+	struct echo e;
+	pthread_t th;
+	int lsk, sk;
+
+	lsk = rc_listen(channel);
+	sk = rc_connect(channel);
+	e.sk = rc_accept(lsk);
+	e.rounds = rounds;
+
+	pthread_create(&th, NULL, echo_thread, &e);
+
+	memset(buf, 0x5a, size);
+
+	for (i = 0; i < rounds; i++) {
+		double t = now();
+
+		write_full(sk, buf, size);
+		read_full(sk, buf, size);
+
+		rtt[i] = (now() - t) * 1e6;
+		sum += rtt[i];
+	}
+
+	pthread_join(th, NULL);
+
+	std::sort(rtt, rtt + rounds);
+
+	printf("latency  %ld x %d bytes: avg %.0f us, p50 %.0f us, "
+			"p99 %.0f us, max %.0f us\n", rounds, size,
+			sum / rounds, rtt[rounds / 2], rtt[rounds * 99 / 100],
+			rtt[rounds - 1]);
+
+	close(sk);
+	close(e.sk);
+	close(lsk);
+	free(buf);
+	delete[] rtt;
+}
+
+/* ---- Connection setup ---- */
+
+static void test_connect(void)
+{
+	long i, rounds = count ? count : 100;
+	double start;
+	int lsk;
+
+	lsk = rc_listen(channel);
+
+	/* Includes L2CAP and session setup each time, the session goes
+	 * away with its last DLC */
+	start = now();
+	for (i = 0; i < rounds; i++) {
+		int sk = rc_connect(channel);
+
+		close(rc_accept(lsk));
+		close(sk);
+	}
+
+	printf("connect  %ld DLCs: %.1f connects/s\n", rounds,
+			rounds / (now() - start));
+
+	close(lsk);
+}
+
+static const struct {
+	const char	*name;
+	void		(*run)(void);
+} tests[] = {
+	{ "sock",	test_sock	},
+	{ "tty",	test_tty	},
+	{ "latency",	test_latency	},
+	{ "mux",	test_mux	},
+	{ "connect",	test_connect	},
+};
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: rfcomm_bench -a src -b dst [-t test] "
+		"[-c channel] [-s size] [-n count] [-d dlcs] [-i tty id]\n"
+		"tests: sock tty latency mux connect all\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *test = "all";
+	bool have_src = false, have_dst = false, found = false;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "a:b:t:c:s:n:d:i:")) != -1) {
+		switch (opt) {
+		case 'a':
+			have_src = !str2ba(optarg, &src);
+			break;
+		case 'b':
+			have_dst = !str2ba(optarg, &dst);
+			break;
+		case 't':
+			test = optarg;
+			break;
+		case 'c':
+			channel = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 'd':
+			dlcs = atoi(optarg);
+			break;
+		case 'i':
+			tty_id = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (!have_src || !have_dst || channel < 1 || channel > 30 ||
+			size <= 0 || count < 0 || dlcs <= 0)
+		usage();
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		if (strcmp(test, "all") && strcmp(test, tests[i].name))
+			continue;
+
+		/* The small message test is about latency, not size */
+		if (!strcmp(test, "all") && tests[i].run == test_latency) {
+			int saved = size;
+
+			size = 16;
+			tests[i].run();
+			size = saved;
+		} else
+			tests[i].run();
+
+		found = true;
+	}
+
+	if (!found)
+		usage();
+
+	return 0;
+}
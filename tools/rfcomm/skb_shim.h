@@ -0,0 +1,99 @@
+/*
+ * Just enough of the kernel for building rfcomm/codec.h in userspace.
+ */
+
+#ifndef __RFCOMM_SKB_SHIM_H
+#define __RFCOMM_SKB_SHIM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+/* Frame types, from <net/bluetooth/rfcomm.h> */
+#define RFCOMM_SABM	0x2f
+#define RFCOMM_DISC	0x43
+#define RFCOMM_UA	0x63
+#define RFCOMM_DM	0x0f
+#define RFCOMM_UIH	0xef
+
+#define RFCOMM_TEST	0x08
+#define RFCOMM_FCON	0x28
+#define RFCOMM_FCOFF	0x18
+#define RFCOMM_MSC	0x38
+#define RFCOMM_RPN	0x24
+#define RFCOMM_RLS	0x14
+#define RFCOMM_PN	0x20
+#define RFCOMM_NSC	0x04
+
+/* Linear buffers only, data_len is there to exercise the paged path */
+struct sk_buff {
+	unsigned char	*head;
+	unsigned char	*data;
+	unsigned char	*tail;
+	unsigned char	*end;
+	unsigned int	len;
+	unsigned int	data_len;
+};
+
+static inline struct sk_buff *alloc_skb(unsigned int size)
+{
+	struct sk_buff *skb = (struct sk_buff *) calloc(1, sizeof(*skb) + size);
+
+	if (!skb)
+		return NULL;
+
+	skb->head = skb->data = skb->tail = (unsigned char *) (skb + 1);
+	skb->end  = skb->head + size;
+	return skb;
+}
+
+static inline void kfree_skb(struct sk_buff *skb)
+{
+	free(skb);
+}
+
+static inline int skb_is_nonlinear(const struct sk_buff *skb)
+{
+	return skb->data_len;
+}
+
+static inline void skb_reserve(struct sk_buff *skb, int len)
+{
+	skb->data += len;
+	skb->tail += len;
+}
+
+static inline void *skb_push(struct sk_buff *skb, unsigned int len)
+{
+	skb->data -= len;
+	skb->len  += len;
+	return skb->data;
+}
+
+static inline void *skb_put(struct sk_buff *skb, unsigned int len)
+{
+	unsigned char *tmp = skb->tail;
+
+	skb->tail += len;
+	skb->len  += len;
+	return tmp;
+}
+
+static inline void *skb_pull(struct sk_buff *skb, unsigned int len)
+{
+	skb->len -= len;
+	return skb->data += len;
+}
+
+static inline void skb_trim(struct sk_buff *skb, unsigned int len)
+{
+	skb->len  = len;
+	skb->tail = skb->data + len;
+}
+
+#endif /* __RFCOMM_SKB_SHIM_H */